@@ -0,0 +1,219 @@
+#include "internal.h"
+
+// Cascades of second-order sections in transposed direct form II,
+// which needs only two states per section and channel, and keeps the
+// chain of dependencies between consecutive samples short.
+//
+// The recursion of a filter cannot be vectorized over time, but the
+// channels are independent, so they are processed side by side instead:
+// each chunk of samples is interleaved into lanes of four or eight
+// channels, run through every section with one lane per channel, and
+// de-interleaved again. The lane loops have a fixed width and compile
+// to plain vector instructions. A single channel skips the lanes.
+//
+// Decaying feedback ends up in denormals, which are very slow on most
+// machines, so the feedback state is flushed to zero between chunks.
+
+#define BIQUAD_CHUNK 64
+#define BIQUAD_MAX_LANES 8
+#define BIQUAD_STATE 2
+
+static inline float flush_denormal(float x){
+  return (fabsf(x) < 1e-30f)? 0.0f : x;
+}
+
+void free_biquad_data(struct biquad_data *data){
+  // The state is carved out of the same allocation.
+  if(data->sections)
+    free(data->sections);
+  data->sections = 0;
+  data->state = 0;
+  data->frame = 0;
+}
+
+int make_biquad_data(size_t channels, size_t size, struct biquad_data *data){
+  size_t lanes = (channels == 1)? 1 : (channels <= 4)? 4 : 8;
+  size_t groups = (channels+lanes-1)/lanes;
+  if(channels == 0 || size == 0){
+    mixed_err(MIXED_INVALID_VALUE);
+    return 0;
+  }
+
+  struct biquad_coefficients *sections = calloc(1, size*sizeof(struct biquad_coefficients)
+                                                + (BIQUAD_STATE*size*groups*lanes + BIQUAD_CHUNK*lanes)*sizeof(float));
+  if(!sections){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    return 0;
+  }
+
+  free_biquad_data(data);
+  data->sections = sections;
+  data->state = (float *)(sections+size);
+  data->frame = data->state + BIQUAD_STATE*size*groups*lanes;
+  data->count = size;
+  data->size = size;
+  data->channels = channels;
+  data->lanes = lanes;
+  // Until set otherwise, every section passes its input unchanged.
+  for(size_t s=0; s<size; ++s){
+    sections[s].b0 = 1.0;
+  }
+  return 1;
+}
+
+void biquad_clear(struct biquad_data *data){
+  size_t groups = (data->channels+data->lanes-1)/data->lanes;
+  memset(data->state, 0, BIQUAD_STATE*data->size*groups*data->lanes*sizeof(float));
+}
+
+void biquad_resize(size_t count, struct biquad_data *data){
+  size_t groups = (data->channels+data->lanes-1)/data->lanes;
+  size_t lanes = data->lanes;
+  // Sections that become active start out from silence.
+  for(size_t g=0; g<groups; ++g){
+    float *state = data->state+BIQUAD_STATE*data->size*lanes*g;
+    for(size_t s=data->count; s<count; ++s){
+      memset(state+BIQUAD_STATE*s*lanes, 0, BIQUAD_STATE*lanes*sizeof(float));
+    }
+  }
+  data->count = count;
+}
+
+// Runs all sections over the interleaved frame. Always inlined with a
+// constant lane count, so that the lane loops have a fixed width.
+static inline void biquad_cascade(float *restrict frame, size_t samples, size_t lanes, float *restrict state, struct biquad_coefficients *sections, size_t count){
+  for(size_t s=0; s<count; ++s){
+    float b0 = sections[s].b0, b1 = sections[s].b1, b2 = sections[s].b2;
+    float a1 = sections[s].a1, a2 = sections[s].a2;
+    // Local copies of the state can be kept in registers.
+    float s1[BIQUAD_MAX_LANES], s2[BIQUAD_MAX_LANES];
+    float *section_state = state+BIQUAD_STATE*s*lanes;
+    memcpy(s1, section_state+0*lanes, lanes*sizeof(float));
+    memcpy(s2, section_state+1*lanes, lanes*sizeof(float));
+    for(size_t t=0; t<samples; ++t){
+      float *restrict x = frame+t*lanes;
+      for(size_t l=0; l<lanes; ++l){
+        float in = x[l];
+        float out = b0*in + s1[l];
+        s1[l] = b1*in - a1*out + s2[l];
+        s2[l] = b2*in - a2*out;
+        x[l] = out;
+      }
+    }
+    for(size_t l=0; l<lanes; ++l){
+      section_state[0*lanes+l] = flush_denormal(s1[l]);
+      section_state[1*lanes+l] = flush_denormal(s2[l]);
+    }
+  }
+}
+
+// A single channel needs no lanes, and its state is kept in registers.
+static void biquad_cascade_single(float *restrict frame, size_t samples, float *restrict state, struct biquad_coefficients *sections, size_t count){
+  for(size_t s=0; s<count; ++s){
+    float b0 = sections[s].b0, b1 = sections[s].b1, b2 = sections[s].b2;
+    float a1 = sections[s].a1, a2 = sections[s].a2;
+    float *section_state = state+BIQUAD_STATE*s;
+    float s1 = section_state[0], s2 = section_state[1];
+    for(size_t t=0; t<samples; ++t){
+      float in = frame[t];
+      float out = b0*in + s1;
+      s1 = b1*in - a1*out + s2;
+      s2 = b2*in - a2*out;
+      frame[t] = out;
+    }
+    section_state[0] = flush_denormal(s1);
+    section_state[1] = flush_denormal(s2);
+  }
+}
+
+void biquad_process(struct mixed_buffer **in, struct mixed_buffer **out, size_t samples, struct biquad_data *data){
+  size_t lanes = data->lanes;
+  size_t count = data->count;
+  float *frame = data->frame;
+
+  for(size_t g=0; g*lanes<data->channels; ++g){
+    size_t channels = smin(lanes, data->channels-g*lanes);
+    float *state = data->state+BIQUAD_STATE*data->size*lanes*g;
+    struct mixed_buffer **group_in = in+g*lanes;
+    struct mixed_buffer **group_out = out+g*lanes;
+    // Unused lanes are only ever fed zeroes.
+    if(channels < lanes){
+      memset(frame, 0, BIQUAD_CHUNK*lanes*sizeof(float));
+    }
+
+    for(size_t i=0; i<samples; i+=BIQUAD_CHUNK){
+      size_t chunk = smin(samples-i, BIQUAD_CHUNK);
+      for(size_t c=0; c<channels; ++c){
+        float *buffer = group_in[c]->data+i;
+        for(size_t t=0; t<chunk; ++t){
+          frame[t*lanes+c] = buffer[t];
+        }
+      }
+      if(lanes == 1){
+        biquad_cascade_single(frame, chunk, state, data->sections, count);
+      }else if(lanes == 4){
+        biquad_cascade(frame, chunk, 4, state, data->sections, count);
+      }else{
+        biquad_cascade(frame, chunk, 8, state, data->sections, count);
+      }
+      for(size_t c=0; c<channels; ++c){
+        float *buffer = group_out[c]->data+i;
+        for(size_t t=0; t<chunk; ++t){
+          buffer[t] = frame[t*lanes+c];
+        }
+      }
+    }
+  }
+}
+
+// Coefficients from the cookbook formulae by Robert Bristow-Johnson.
+static void normalize_biquad(float b0, float b1, float b2, float a0, float a1, float a2, struct biquad_coefficients *c){
+  c->b0 = b0/a0;
+  c->b1 = b1/a0;
+  c->b2 = b2/a0;
+  c->a1 = a1/a0;
+  c->a2 = a2/a0;
+}
+
+void biquad_lowpass(float frequency, float q, size_t samplerate, struct biquad_coefficients *c){
+  float w = 2*M_PI*frequency/samplerate;
+  float cw = cos(w), alpha = sin(w)/(2*q);
+  normalize_biquad((1-cw)/2, 1-cw, (1-cw)/2, 1+alpha, -2*cw, 1-alpha, c);
+}
+
+void biquad_highpass(float frequency, float q, size_t samplerate, struct biquad_coefficients *c){
+  float w = 2*M_PI*frequency/samplerate;
+  float cw = cos(w), alpha = sin(w)/(2*q);
+  normalize_biquad((1+cw)/2, -(1+cw), (1+cw)/2, 1+alpha, -2*cw, 1-alpha, c);
+}
+
+void biquad_peak(float frequency, float q, float gain, size_t samplerate, struct biquad_coefficients *c){
+  float a = pow(10.0, gain/40.0);
+  float w = 2*M_PI*frequency/samplerate;
+  float cw = cos(w), alpha = sin(w)/(2*q);
+  normalize_biquad(1+alpha*a, -2*cw, 1-alpha*a, 1+alpha/a, -2*cw, 1-alpha/a, c);
+}
+
+void biquad_low_shelf(float frequency, float q, float gain, size_t samplerate, struct biquad_coefficients *c){
+  float a = pow(10.0, gain/40.0);
+  float w = 2*M_PI*frequency/samplerate;
+  float cw = cos(w), alpha = sin(w)/(2*q);
+  float sa = 2*sqrt(a)*alpha;
+  normalize_biquad(a*((a+1) - (a-1)*cw + sa), 2*a*((a-1) - (a+1)*cw), a*((a+1) - (a-1)*cw - sa),
+                   (a+1) + (a-1)*cw + sa, -2*((a-1) + (a+1)*cw), (a+1) + (a-1)*cw - sa, c);
+}
+
+void biquad_high_shelf(float frequency, float q, float gain, size_t samplerate, struct biquad_coefficients *c){
+  float a = pow(10.0, gain/40.0);
+  float w = 2*M_PI*frequency/samplerate;
+  float cw = cos(w), alpha = sin(w)/(2*q);
+  float sa = 2*sqrt(a)*alpha;
+  normalize_biquad(a*((a+1) + (a-1)*cw + sa), -2*a*((a-1) + (a+1)*cw), a*((a+1) + (a-1)*cw - sa),
+                   (a+1) - (a-1)*cw + sa, 2*((a-1) - (a+1)*cw), (a+1) - (a-1)*cw - sa, c);
+}
+
+void biquad_allpass(float frequency, float q, size_t samplerate, struct biquad_coefficients *c){
+  float w = 2*M_PI*frequency/samplerate;
+  float cw = cos(w), alpha = sin(w)/(2*q);
+  normalize_biquad(1-alpha, -2*cw, 1+alpha, 1+alpha, -2*cw, 1-alpha, c);
+}
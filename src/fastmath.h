@@ -0,0 +1,124 @@
+// Float approximations of transcendental functions.
+//
+// These are meant for loops that run per sample or per bin. Unlike the
+// libm functions, they are inlined, work in single precision, and
+// contain no branches or calls, so the compiler can vectorize loops
+// that use them. The error bounds below are the maximal errors measured
+// against double precision libm over the stated domain.
+//
+// Segments that use these offer the MIXED_FAST_MATH field, so that the
+// libm functions can be used instead where precision matters more.
+
+static inline uint32_t float_bits(float f){
+  union { float f; uint32_t i; } v = {f};
+  return v.i;
+}
+
+static inline float bits_float(uint32_t i){
+  union { uint32_t i; float f; } v = {i};
+  return v.f;
+}
+
+// Picks a where the mask is set and b elsewhere. Selecting through
+// the bits keeps the compiler from having to branch on float compares.
+static inline float select_float(uint32_t mask, float a, float b){
+  return bits_float((float_bits(a) & mask) | (float_bits(b) & ~mask));
+}
+
+// Rounds to the nearest integer for values within the range of int.
+static inline int round_int(float x){
+  return (int)(x + ((x < 0.f)? -0.5f : 0.5f));
+}
+
+// Relative error below 3e-7 for x within [-126, 127].
+static inline float fast_exp2(float x){
+  int whole = round_int(x);
+  float f = x - (float)whole;
+  float p = 1.f + f*(0.69314718f + f*(0.24022651f + f*(0.05550411f + f*(0.00961813f + f*(0.00133336f + f*0.00015404f)))));
+  return p * bits_float((uint32_t)(whole + 127) << 23);
+}
+
+// For positive, normal x the error is below 2e-7, absolute for results
+// within +/- 1 and relative beyond.
+static inline float fast_log2(float x){
+  uint32_t bits = float_bits(x);
+  // Split into an exponent and a mantissa within [sqrt(1/2), sqrt(2)).
+  int exponent = (int)((bits + 0x004afb0d) >> 23) - 127;
+  float m = bits_float(bits - ((uint32_t)exponent << 23));
+  float t = (m - 1.f)/(m + 1.f);
+  float t2 = t*t;
+  float a = t*(2.f + t2*(2.f/3 + t2*(2.f/5 + t2*(2.f/7 + t2*(2.f/9)))));
+  return (float)exponent + a*(float)M_LOG2E;
+}
+
+// Relative error below 2e-6 for positive x and |y*log2(x)| < 16.
+static inline float fast_pow(float x, float y){
+  return fast_exp2(y*fast_log2(x));
+}
+
+// Relative error below 1e-6 for db within +/- 96.
+static inline float fast_db_to_linear(float db){
+  return fast_exp2(db*(float)(M_LN10/(20*M_LN2)));
+}
+
+// Same as fast_log2, but below 3e-7 dB.
+static inline float fast_linear_to_db(float linear){
+  return fast_log2(linear)*(float)(20*M_LN2/M_LN10);
+}
+
+// Maps the phase into +/- Pi. Two Pi is subtracted in two parts, the
+// first of which is exact in few bits, so that no precision is lost
+// for phases of up to some thousand turns.
+static inline float wrap_phase(float x){
+  float whole = (float)round_int(x*(float)(0.5/M_PI));
+  return (x - whole*6.28125f) - whole*1.9353071795864769e-3f;
+}
+
+// Absolute error below 3e-7 for x within +/- Pi.
+static inline void fast_sincos(float x, float *s, float *c){
+  // Fold into +/- Pi/2, where the series converge quickly.
+  uint32_t fold = -(uint32_t)(float_bits((float)M_PI_2) < float_bits(fabsf(x)));
+  x = select_float(fold, copysignf((float)M_PI, x) - x, x);
+  float x2 = x*x;
+  *s = x*(1.f + x2*(-1.f/6 + x2*(1.f/120 + x2*(-1.f/5040 + x2*(1.f/362880 + x2*(-1.f/39916800))))));
+  float cx = 1.f + x2*(-1.f/2 + x2*(1.f/24 + x2*(-1.f/720 + x2*(1.f/40320 + x2*(-1.f/3628800 + x2*(1.f/479001600))))));
+  *c = bits_float(float_bits(cx) ^ (fold & 0x80000000));
+}
+
+// Absolute error below 3e-7 for |x| < 1000, growing with the rounding
+// of x itself beyond that.
+static inline float fast_sin(float x){
+  float s, c;
+  fast_sincos(wrap_phase(x), &s, &c);
+  return s;
+}
+
+// Same as fast_sin.
+static inline float fast_cos(float x){
+  float s, c;
+  fast_sincos(wrap_phase(x), &s, &c);
+  return c;
+}
+
+// Relative error below 4e-6 for |x| < 0.98*Pi/2.
+static inline float fast_tan(float x){
+  float s, c;
+  fast_sincos(x, &s, &c);
+  return s/c;
+}
+
+// Absolute error below 2e-6 radians.
+static inline float fast_atan2(float y, float x){
+  float ax = fabsf(x), ay = fabsf(y);
+  // Positive floats order the same as their bits.
+  uint32_t swap = -(uint32_t)(float_bits(ax) < float_bits(ay));
+  float mx = select_float(swap, ay, ax);
+  float mn = select_float(swap, ax, ay);
+  // The bias avoids a branch for zero, and is too small to matter otherwise.
+  float z = mn/(mx + 1e-37f);
+  float z2 = z*z;
+  float a = z*(0.99997726f + z2*(-0.33262347f + z2*(0.19354346f + z2*(-0.11643287f + z2*(0.05265332f + z2*(-0.01172120f))))));
+  a = select_float(swap, (float)M_PI_2 - a, a);
+  a = select_float(-(float_bits(x) >> 31), (float)M_PI - a, a);
+  return copysignf(a, y);
+}
@@ -0,0 +1,286 @@
+#include "internal.h"
+
+// The real transform of size N is computed through a complex transform
+// of size N/2, treating even samples as the real and odd samples as the
+// imaginary part. The complex transform is an iterative decimation in
+// time FFT that fuses pairs of radix-2 stages into radix-4 butterflies,
+// halving the passes over the data. All twiddle factors and the bit
+// reversal permutation are computed once when the plan is made.
+
+static size_t reverse_bits(size_t i, size_t bits){
+  size_t r = 0;
+  for(size_t b=0; b<bits; ++b){
+    r = (r << 1) | (i & 1);
+    i >>= 1;
+  }
+  return r;
+}
+
+void free_fft_plan(struct fft_plan *plan){
+  if(plan->bitrev)
+    free(plan->bitrev);
+  plan->bitrev = 0;
+
+  if(plan->twiddles)
+    free(plan->twiddles);
+  plan->twiddles = 0;
+
+  if(plan->real_twiddles)
+    free(plan->real_twiddles);
+  plan->real_twiddles = 0;
+}
+
+int make_fft_plan(size_t size, struct fft_plan *plan){
+  size_t n = size/2;
+  size_t bits = 0;
+  while(((size_t)1 << bits) < n) ++bits;
+  if(size < 4 || ((size_t)1 << bits) != n){
+    mixed_err(MIXED_INVALID_VALUE);
+    return 0;
+  }
+
+  plan->bitrev = calloc(n, sizeof(size_t));
+  plan->twiddles = calloc(2*n, sizeof(float));
+  plan->real_twiddles = calloc(n+2, sizeof(float));
+  if(!plan->bitrev || !plan->twiddles || !plan->real_twiddles){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    free_fft_plan(plan);
+    return 0;
+  }
+
+  plan->size = size;
+  plan->bits = bits;
+
+  for(size_t i=0; i<n; ++i){
+    plan->bitrev[i] = reverse_bits(i, bits);
+  }
+
+  // Twiddles are stored contiguously per fused stage, as the pairs
+  // W(2h)^j, W(4h)^j for j below the quarter block size h.
+  float *w = plan->twiddles;
+  for(size_t h=(bits%2)?2:1; 4*h<=n; h*=4){
+    for(size_t j=0; j<h; ++j){
+      w[0] = cos(M_PI*j/h);
+      w[1] = -sin(M_PI*j/h);
+      w[2] = cos(M_PI*j/(2*h));
+      w[3] = -sin(M_PI*j/(2*h));
+      w += 4;
+    }
+  }
+
+  for(size_t k=0; k<=n/2; ++k){
+    plan->real_twiddles[2*k] = cos(2.0*M_PI*k/size);
+    plan->real_twiddles[2*k+1] = -sin(2.0*M_PI*k/size);
+  }
+  return 1;
+}
+
+// In-place complex transform of size/2 interleaved points. The sign
+// selects the direction, -1 being the inverse.
+static void complex_fft(float *data, float sign, struct fft_plan *plan){
+  size_t n = plan->size/2;
+  size_t *bitrev = plan->bitrev;
+
+  for(size_t i=0; i<n; ++i){
+    size_t j = bitrev[i];
+    if(i < j){
+      float re = data[2*i], im = data[2*i+1];
+      data[2*i] = data[2*j];
+      data[2*i+1] = data[2*j+1];
+      data[2*j] = re;
+      data[2*j+1] = im;
+    }
+  }
+
+  size_t h = 1;
+  if(plan->bits % 2){
+    // An odd number of stages leaves one plain radix-2 stage.
+    for(size_t i=0; i<2*n; i+=4){
+      float re = data[i+2], im = data[i+3];
+      data[i+2] = data[i] - re;
+      data[i+3] = data[i+1] - im;
+      data[i] += re;
+      data[i+1] += im;
+    }
+    h = 2;
+  }
+
+  float *w = plan->twiddles;
+  for(; 4*h<=n; h*=4){
+    for(size_t b=0; b<n; b+=4*h){
+      float *x0 = data + 2*b;
+      float *x1 = x0 + 2*h;
+      float *x2 = x1 + 2*h;
+      float *x3 = x2 + 2*h;
+      for(size_t j=0; j<h; ++j){
+        float w1r = w[4*j], w1i = sign*w[4*j+1];
+        float w2r = w[4*j+2], w2i = sign*w[4*j+3];
+        // W(4h)^(j+h) is W(4h)^j rotated by a quarter turn.
+        float w3r = sign*w2i, w3i = -sign*w2r;
+        float a0r = x0[2*j], a0i = x0[2*j+1];
+        float a1r = x1[2*j], a1i = x1[2*j+1];
+        float a2r = x2[2*j], a2i = x2[2*j+1];
+        float a3r = x3[2*j], a3i = x3[2*j+1];
+        // First stage: blocks of size 2h
+        float t1r = w1r*a1r - w1i*a1i, t1i = w1r*a1i + w1i*a1r;
+        float t3r = w1r*a3r - w1i*a3i, t3i = w1r*a3i + w1i*a3r;
+        float b0r = a0r + t1r, b0i = a0i + t1i;
+        float b1r = a0r - t1r, b1i = a0i - t1i;
+        float b2r = a2r + t3r, b2i = a2i + t3i;
+        float b3r = a2r - t3r, b3i = a2i - t3i;
+        // Second stage: blocks of size 4h
+        float u2r = w2r*b2r - w2i*b2i, u2i = w2r*b2i + w2i*b2r;
+        float u3r = w3r*b3r - w3i*b3i, u3i = w3r*b3i + w3i*b3r;
+        x0[2*j] = b0r + u2r; x0[2*j+1] = b0i + u2i;
+        x2[2*j] = b0r - u2r; x2[2*j+1] = b0i - u2i;
+        x1[2*j] = b1r + u3r; x1[2*j+1] = b1i + u3i;
+        x3[2*j] = b1r - u3r; x3[2*j+1] = b1i - u3i;
+      }
+    }
+    w += 4*h;
+  }
+}
+
+void fft_forward(float *in, float *out, struct fft_plan *plan){
+  size_t size = plan->size;
+  size_t n = size/2;
+  float *w = plan->real_twiddles;
+  if(in != out) memcpy(out, in, size*sizeof(float));
+  complex_fft(out, 1.0, plan);
+
+  // Untangle the spectra of the even and odd samples.
+  float r = out[0], i = out[1];
+  out[0] = r + i;
+  out[1] = 0.0;
+  out[size] = r - i;
+  out[size+1] = 0.0;
+  for(size_t k=1; k<=n/2; ++k){
+    size_t m = n-k;
+    float ar = out[2*k], ai = out[2*k+1];
+    float br = out[2*m], bi = out[2*m+1];
+    float er = 0.5*(ar + br), ei = 0.5*(ai - bi);
+    float or = 0.5*(ai + bi), oi = -0.5*(ar - br);
+    float pr = w[2*k]*or - w[2*k+1]*oi;
+    float pi = w[2*k]*oi + w[2*k+1]*or;
+    out[2*k] = er + pr;
+    out[2*k+1] = ei + pi;
+    out[2*m] = er - pr;
+    out[2*m+1] = -(ei - pi);
+  }
+}
+
+void fft_inverse(float *in, float *out, struct fft_plan *plan){
+  size_t size = plan->size;
+  size_t n = size/2;
+  float *w = plan->real_twiddles;
+
+  // Recombine into the spectrum of the interleaved samples.
+  float r = in[0], i = in[size];
+  out[0] = r + i;
+  out[1] = r - i;
+  for(size_t k=1; k<=n/2; ++k){
+    size_t m = n-k;
+    float ar = in[2*k], ai = in[2*k+1];
+    float br = in[2*m], bi = in[2*m+1];
+    float sr = ar + br, si = ai - bi;
+    float dr = ar - br, di = ai + bi;
+    float qr = w[2*k]*dr + w[2*k+1]*di;
+    float qi = w[2*k]*di - w[2*k+1]*dr;
+    out[2*k] = sr - qi;
+    out[2*k+1] = si + qr;
+    out[2*m] = sr + qi;
+    out[2*m+1] = -si + qr;
+  }
+  complex_fft(out, -1.0, plan);
+}
+
+// Plans and windows are read-only once made, so instances with the
+// same frame configuration share them. The cache is a plain list, as
+// there are only ever a handful of distinct configurations.
+static struct fft_tables *tables_cache = 0;
+static volatile int tables_lock = 0;
+
+static void lock_tables(){
+  while(__sync_lock_test_and_set(&tables_lock, 1));
+}
+
+static void unlock_tables(){
+  __sync_lock_release(&tables_lock);
+}
+
+static void free_fft_tables(struct fft_tables *tables){
+  free_fft_plan(&tables->plan);
+  if(tables->window)
+    free(tables->window);
+  free(tables);
+}
+
+static struct fft_tables *make_fft_tables(size_t framesize, size_t oversampling){
+  struct fft_tables *tables = calloc(1, sizeof(struct fft_tables));
+  if(!tables){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    return 0;
+  }
+  if(!make_fft_plan(framesize, &tables->plan)){
+    free(tables);
+    return 0;
+  }
+  tables->window = calloc(2*framesize, sizeof(float));
+  if(!tables->window){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    free_fft_tables(tables);
+    return 0;
+  }
+  tables->synthesis_window = tables->window + framesize;
+  tables->framesize = framesize;
+  tables->oversampling = oversampling;
+  tables->references = 1;
+  // Hann window for analysis and synthesis. The synthesis side is
+  // divided by the sum of the squared windows overlapping each sample
+  // and by the scale of the inverse transform, so that an unmodified
+  // spectrum is reconstructed exactly.
+  size_t step = framesize/oversampling;
+  for(size_t k=0; k<framesize; ++k){
+    tables->window[k] = -.5*cos(2.*M_PI*(double)k/(double)framesize)+.5;
+  }
+  for(size_t k=0; k<framesize; ++k){
+    double sum = 0.0;
+    for(size_t j=k%step; j<framesize; j+=step){
+      sum += tables->window[j]*tables->window[j];
+    }
+    tables->synthesis_window[k] = (0.0 < sum)? tables->window[k]/(sum*framesize) : 0.0;
+  }
+  return tables;
+}
+
+struct fft_tables *acquire_fft_tables(size_t framesize, size_t oversampling){
+  struct fft_tables *tables;
+  lock_tables();
+  for(tables=tables_cache; tables; tables=tables->next){
+    if(tables->framesize == framesize && tables->oversampling == oversampling){
+      ++tables->references;
+      break;
+    }
+  }
+  if(!tables){
+    tables = make_fft_tables(framesize, oversampling);
+    if(tables){
+      tables->next = tables_cache;
+      tables_cache = tables;
+    }
+  }
+  unlock_tables();
+  return tables;
+}
+
+void release_fft_tables(struct fft_tables *tables){
+  if(!tables) return;
+  lock_tables();
+  if(--tables->references == 0){
+    struct fft_tables **prev = &tables_cache;
+    while(*prev != tables) prev = &(*prev)->next;
+    *prev = tables->next;
+    free_fft_tables(tables);
+  }
+  unlock_tables();
+}
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <time.h>
 #include "mixed.h"
+#include "fastmath.h"
 #ifdef __RDRND__
 #include <cpuid.h>
 #include <immintrin.h>
@@ -34,27 +35,195 @@ int vector_remove_pos(size_t i, struct vector *vector);
 int vector_remove_item(void *element, struct vector *vector);
 int vector_clear(struct vector *vector);
 
-struct pitch_data{
+struct fft_plan{
+  size_t size;
+  size_t bits;
+  size_t *bitrev;
+  float *twiddles;
+  float *real_twiddles;
+};
+
+// Plans a real transform of the given size, which must be a power of two.
+int make_fft_plan(size_t size, struct fft_plan *plan);
+void free_fft_plan(struct fft_plan *plan);
+// Transforms size real samples into size/2+1 interleaved complex bins.
+// The output needs to hold size+2 floats and may be the same as the input.
+void fft_forward(float *in, float *out, struct fft_plan *plan);
+// Transforms size/2+1 complex bins back into size real samples, scaled
+// by size. The output may be the same as the input.
+void fft_inverse(float *in, float *out, struct fft_plan *plan);
+
+// Read-only tables shared between all users of the same frame
+// configuration. The synthesis window includes the normalisation
+// of the weighted overlap-add.
+struct fft_tables{
+  struct fft_plan plan;
+  float *window;
+  float *synthesis_window;
+  size_t framesize;
+  size_t oversampling;
+  size_t references;
+  struct fft_tables *next;
+};
+
+// Returns the shared tables for the configuration, creating them if
+// necessary. Every acquire must be matched by a release.
+struct fft_tables *acquire_fft_tables(size_t framesize, size_t oversampling);
+void release_fft_tables(struct fft_tables *tables);
+
+// A circular buffer of samples that is accessed in blocks. Every block
+// starts at the index, and moves it past its end.
+struct ring_data{
+  float *data;
+  size_t size;
+  size_t index;
+};
+
+void free_ring_data(struct ring_data *data);
+int make_ring_data(size_t size, struct ring_data *data);
+void ring_clear(struct ring_data *data);
+// Resizing discards the contents, unless the size stays the same.
+int ring_resize(size_t size, struct ring_data *data);
+void ring_read(float *out, size_t samples, struct ring_data *data);
+void ring_write(float *in, size_t samples, struct ring_data *data);
+// Reads the block into out and replaces it with in. They may be the
+// same buffer.
+void ring_exchange(float *in, float *out, size_t samples, struct ring_data *data);
+
+struct stft_data;
+
+// A spectral effect run on every frame of an STFT. The spectrum holds
+// framesize/2+1 interleaved complex bins and is modified in place.
+struct stft_stage{
+  void (*process)(float *spectrum, struct stft_data *stft, void *user);
+  void *user;
+};
+
+// Short-time Fourier transform with Hann windows and weighted
+// overlap-add. The stages are run in order on the same frame, so
+// chained effects share one analysis and synthesis.
+struct stft_data{
+  struct fft_tables *tables;
+  struct vector stages;
   float *in_fifo;
   float *out_fifo;
-  float *fft_workspace;
+  float *accumulator;
+  float *spectrum;
+  size_t framesize;
+  size_t oversampling;
+  size_t fill;
+};
+
+void free_stft_data(struct stft_data *data);
+int make_stft_data(size_t framesize, size_t oversampling, struct stft_data *data);
+// The stage is not copied, and must stay valid until it is removed.
+int stft_add_stage(struct stft_stage *stage, struct stft_data *data);
+int stft_remove_stage(struct stft_stage *stage, struct stft_data *data);
+size_t stft_latency(struct stft_data *data);
+void stft_process(float *in, float *out, size_t samples, struct stft_data *data);
+
+struct pitch_data{
+  struct stft_data stft;
+  struct stft_stage stage;
+  // The per-bin arrays are padded to a whole number of lanes.
+  float *real;
+  float *imag;
   float *last_phase;
   float *phase_sum;
-  float *output_accumulator;
   float *analyzed_frequency;
   float *analyzed_magnitude;
   float *synthesized_frequency;
   float *synthesized_magnitude;
+  float pitch;
   long framesize;
   long oversampling;
-  long overlap;
   long samplerate;
+  // Holds the output back to line up with an earlier configuration.
+  struct ring_data delay;
+  // While switching, the previous configuration, and the delay that
+  // lines its output up with this one.
+  struct pitch_data *previous;
+  struct ring_data lag;
+  size_t transition;
+  bool started;
+  bool fast_math;
 };
 
 void free_pitch_data(struct pitch_data *data);
 int make_pitch_data(size_t framesize, size_t oversampling, size_t samplerate, struct pitch_data *data);
+// Switches to a new configuration without interrupting the output.
+int reconfigure_pitch_data(size_t framesize, size_t oversampling, size_t samplerate, struct pitch_data *data);
+// The two halves of a reconfiguration. Preparing allocates everything
+// the switch needs into next and leaves data untouched. Committing
+// cannot fail. A prepared configuration that is not committed is freed
+// with free_pitch_data.
+int prepare_pitch_data(size_t framesize, size_t oversampling, size_t samplerate, struct pitch_data *data, struct pitch_data *next);
+void commit_pitch_data(struct pitch_data *next, struct pitch_data *data);
+// Whether to use the approximations of fastmath.h, which is the default.
+void pitch_fast_math(bool fast_math, struct pitch_data *data);
+size_t pitch_latency(struct pitch_data *data);
 void pitch_shift(float pitch, float *in, float *out, size_t samples, struct pitch_data *data);
 
+// Normalised coefficients of a second-order section.
+struct biquad_coefficients{
+  float b0, b1, b2;
+  float a1, a2;
+};
+
+// A cascade of second-order sections applied to several channels,
+// which are processed in parallel lanes.
+struct biquad_data{
+  struct biquad_coefficients *sections;
+  float *state;
+  float *frame;
+  size_t count;
+  size_t size;
+  size_t channels;
+  size_t lanes;
+};
+
+void free_biquad_data(struct biquad_data *data);
+// All sections start out passing their input unchanged. Coefficients
+// may be changed at any time without clearing the state.
+int make_biquad_data(size_t channels, size_t size, struct biquad_data *data);
+void biquad_clear(struct biquad_data *data);
+// Only the first count of the allocated sections are applied.
+void biquad_resize(size_t count, struct biquad_data *data);
+void biquad_process(struct mixed_buffer **in, struct mixed_buffer **out, size_t samples, struct biquad_data *data);
+void biquad_lowpass(float frequency, float q, size_t samplerate, struct biquad_coefficients *c);
+void biquad_highpass(float frequency, float q, size_t samplerate, struct biquad_coefficients *c);
+void biquad_allpass(float frequency, float q, size_t samplerate, struct biquad_coefficients *c);
+// The gain of these is in dB.
+void biquad_peak(float frequency, float q, float gain, size_t samplerate, struct biquad_coefficients *c);
+void biquad_low_shelf(float frequency, float q, float gain, size_t samplerate, struct biquad_coefficients *c);
+void biquad_high_shelf(float frequency, float q, float gain, size_t samplerate, struct biquad_coefficients *c);
+
+struct wsola_data{
+  struct fft_tables *tables;
+  float *history;
+  float *window;
+  float *ola;
+  float *ready;
+  float *search;
+  float *target;
+  float *energy;
+  size_t grain;
+  size_t hop;
+  size_t range;
+  size_t overlap;
+  size_t history_size;
+  size_t correlation_size;
+  size_t written;
+  size_t ready_pos;
+  double position;
+  bool started;
+};
+
+void free_wsola_data(struct wsola_data *data);
+int make_wsola_data(size_t samplerate, struct wsola_data *data);
+void wsola_shift(float pitch, float *in, float *out, size_t samples, struct wsola_data *data);
+size_t wsola_latency(float pitch, struct wsola_data *data);
+
 int mix_noop(size_t samples, struct mixed_segment *segment);
 
 void mixed_err(int errorcode);
@@ -66,4 +235,7 @@ void clear_info_field(struct mixed_segment_field_info *info);
 
 size_t smin(size_t a, size_t b);
 
+float db_to_linear(float db);
+float linear_to_db(float linear);
+
 extern float (*mixed_random)();
@@ -187,8 +187,8 @@ extern "C" {
     // The default is 10.
     MIXED_SPACE_MIN_DISTANCE,
     // Access the maximal distance as a float.
-    // Any distance greater than this will make the sound
-    // appear at its minimal volume.
+    // Any source further away than this is considered to
+    // be inaudible and will not be mixed.
     // The default is 100000.
     MIXED_SPACE_MAX_DISTANCE,
     // Access the rolloff factor as a float.
@@ -211,6 +211,9 @@ extern "C" {
     //
     // The function should return a float describing the
     // volume multiplier of the source.
+    // The function is not called while mixing. Instead it
+    // is sampled into a lookup table whenever this field,
+    // or the distance or rolloff fields, are set.
     // The default is attenuation_exponential.
     MIXED_SPACE_ATTENUATION,
     // Access the time, in seconds, by which the sound is
@@ -262,6 +265,190 @@ extern "C" {
     // Returns the current segment in the queue.
     // The value is a pointer to a struct mixed_segment.
     MIXED_CURRENT_SEGMENT,
+    // Access the priority of a source as a float.
+    // If more sources are audible than can be mixed, the
+    // ones with the highest priority times volume win.
+    // The default is 1.
+    MIXED_SPACE_PRIORITY,
+    // Access the maximal number of sources that are mixed
+    // at the same time as a size_t. Zero means no limit.
+    // The default is 0.
+    MIXED_SPACE_MAX_VOICES,
+    // Returns the number of sources that were mixed during
+    // the last mix as a size_t.
+    MIXED_SPACE_REAL_VOICES,
+    // Returns the number of sources that were virtual, i.e.
+    // advanced but not mixed, during the last mix as a size_t.
+    MIXED_SPACE_VIRTUAL_VOICES,
+    // Access the cell size of the spatial index as a float.
+    // If larger than zero, sources are kept in a uniform
+    // grid of this cell size and only sources within the
+    // maximal distance of the listener are considered for
+    // mixing. Sources outside of that range are virtual: their
+    // source segments are still mixed to keep their position,
+    // but their distance and volume are not computed.
+    // The default is 0, meaning no index is used.
+    MIXED_SPACE_GRID_SIZE,
+    // Accepts a size_t between 0 and 3.
+    // If larger than zero, sources are encoded into an ambisonic
+    // bus of this order for each listener, which is then rotated
+    // and decoded to the listener's outputs once per mix. This
+    // makes the per-source cost a few multiply-adds per bus
+    // channel, regardless of the decoding. Order 1 uses 4, order
+    // 2 uses 9, and order 3 uses 16 channels.
+    // The default is 0, meaning sources are panned directly.
+    MIXED_SPACE_AMBISONIC_ORDER,
+    // Access the algorithm used to shift the pitch.
+    // The value is an enum mixed_pitch_algorithm.
+    // The default is MIXED_PITCH_VOCODER.
+    MIXED_PITCH_ALGORITHM,
+    // Access the frame size of the phase vocoder as a size_t.
+    // Must be a power of two. Larger frames resolve lower
+    // frequencies better, but increase latency.
+    // The default is 2048.
+    MIXED_PITCH_FRAMESIZE,
+    // Access the oversampling of the phase vocoder as a size_t.
+    // Must be a power of two of at least 2 and at most the frame
+    // size. Higher oversampling improves quality at a higher CPU
+    // cost. Values below 4 noticeably smear the shifted signal.
+    // The default is 4.
+    MIXED_PITCH_OVERSAMPLING,
+    // Returns the algorithmic latency of the segment's processing
+    // in samples as a size_t. For the pitch segment this includes
+    // the delay that lines up a reconfigured phase vocoder.
+    MIXED_LATENCY,
+    // Access the partition size of a convolution as a size_t.
+    // Must be a power of two. The output is delayed by this many
+    // samples, so it is best set to the mixing block size. Smaller
+    // partitions cost more CPU for long impulse responses.
+    // The default is the one given on creation.
+    MIXED_CONVOLUTION_PARTITION,
+    // Access the number of delay lines of the reverb as a size_t.
+    // Must be 8 or 16. More lines give a denser reverb at about
+    // twice the CPU cost. Changing it clears the reverb's tail.
+    // The default is 8.
+    MIXED_REVERB_LINES,
+    // Access the time, in seconds, it takes the reverb to decay
+    // by 60dB as a float.
+    // The default is 1.5s.
+    MIXED_REVERB_TIME,
+    // Access the size factor of the reverb's room as a float.
+    // The delay lines are scaled by this factor, which must be
+    // within [0.1, 10]. Changing it clears the reverb's tail.
+    // The default is 1.
+    MIXED_REVERB_SIZE,
+    // Access how much faster high frequencies decay in the reverb
+    // as a float in [0, 1[. Zero decays all frequencies equally.
+    // The default is 0.3.
+    MIXED_REVERB_DAMPING,
+    // Access the share of the reverberated signal in the output
+    // as a float in [0, 1]. Zero outputs the input unchanged, one
+    // outputs only the reverb.
+    // The default is 0.3.
+    MIXED_REVERB_MIX,
+    // Access the threshold of the compressor in dB as a float.
+    // Levels above the threshold are reduced according to the
+    // ratio. Must not be above 0dB.
+    // The default is -1dB.
+    MIXED_COMPRESSOR_THRESHOLD,
+    // Access the ratio of the compressor as a float.
+    // A level exceeding the threshold by the ratio times some dB
+    // is output as exceeding it by only that many dB. Must be at
+    // least 1. An infinite ratio makes the compressor a limiter
+    // whose output never exceeds the threshold.
+    // The default is INFINITY.
+    MIXED_COMPRESSOR_RATIO,
+    // Access the gain applied before compressing in dB as a float.
+    // The default is 0dB.
+    MIXED_COMPRESSOR_PREGAIN,
+    // Access the lookahead time of the compressor in seconds as a
+    // float. The gain is lowered over this time ahead of a peak,
+    // which also delays the output by as much. Must be within
+    // [0, 1].
+    // The default is 0.005s.
+    MIXED_COMPRESSOR_LOOKAHEAD,
+    // Access the release time of the compressor in seconds as a
+    // float. This is the time constant with which the gain
+    // recovers after a peak.
+    // The default is 0.1s.
+    MIXED_COMPRESSOR_RELEASE,
+    // Returns the current gain reduction of the compressor in dB
+    // as a float.
+    MIXED_COMPRESSOR_REDUCTION,
+    // Access the level of the key in dB above which the ducker
+    // lowers its inputs as a float. The inputs are lowered by as
+    // much as the key exceeds the threshold, up to the depth.
+    // The default is -40dB.
+    MIXED_DUCKER_THRESHOLD,
+    // Access the maximal reduction of the ducker in dB as a float.
+    // The default is 12dB.
+    MIXED_DUCKER_DEPTH,
+    // Access the time constant in seconds with which the ducker's
+    // reduction follows a rising key as a float.
+    // The default is 0.05s.
+    MIXED_DUCKER_ATTACK,
+    // Access the time constant in seconds with which the ducker's
+    // reduction recovers after the key falls as a float.
+    // The default is 0.5s.
+    MIXED_DUCKER_RELEASE,
+    // Returns the current reduction of the ducker in dB as a float.
+    MIXED_DUCKER_REDUCTION,
+    // Access the number of channels a segment processes as a size_t.
+    // Input and output N both belong to channel N. Changing it clears
+    // the segment's internal state.
+    // The default is 1.
+    MIXED_CHANNELS,
+    // Access the cutoff frequency of the state variable filter in Hz
+    // as a float. Changes are ramped over the next mix. It is ignored
+    // while a cutoff input buffer is attached.
+    MIXED_SVF_CUTOFF,
+    // Access the quality factor of the state variable filter as a
+    // float. Higher values give a sharper resonance at the cutoff.
+    // The default is 0.707, which gives a Butterworth response.
+    MIXED_SVF_RESONANCE,
+    // Access the number of active bands of the equalizer as a
+    // size_t. At most 16 bands are available. Every active band
+    // must lie below nyquist, so that the equalizer rejects a
+    // samplerate or band count that would break this.
+    // The default is 0.
+    MIXED_EQUALIZER_BANDS,
+    // Access the parameters of one band of the equalizer. The
+    // value is a struct mixed_equalizer_band, whose index selects
+    // the band. Changes take effect at the start of the next mix.
+    MIXED_EQUALIZER_BAND,
+    // Access the frequencies in Hz at which the crossover splits its
+    // bands. The value is an array of one float less than there are
+    // bands, which must be in ascending order.
+    // By default they are spread evenly between 100Hz and 10kHz.
+    MIXED_CROSSOVER_FREQUENCIES,
+    // Access how the gate measures the level of its input. The
+    // value is an enum mixed_gate_detector.
+    // The default is MIXED_GATE_PEAK.
+    MIXED_GATE_DETECTOR,
+    // Access whether the segment evaluates functions such as sin or
+    // pow with float approximations rather than the exact versions of
+    // the C library, as a bool. The approximations are considerably
+    // faster and accurate to within a few parts per million, which is
+    // far below what is audible.
+    // The default is true.
+    MIXED_FAST_MATH,
+    // Access the number of partials of the additive generator as a
+    // size_t. Partials that are added start out silent.
+    // The default is 0.
+    MIXED_GENERATOR_PARTIALS,
+    // Access the parameters of one partial of the additive generator.
+    // The value is a struct mixed_generator_partial, whose index
+    // selects the partial.
+    MIXED_GENERATOR_PARTIAL,
+    // Access the longest time in seconds that the delay line can
+    // delay by, as a float. Changing it reallocates and clears the
+    // line, so it should not be done while mixing.
+    // The default is given in the constructor.
+    MIXED_DELAY_MAX_TIME,
+    // Access how the delay line interpolates between samples. The
+    // value is an enum mixed_delay_interpolation.
+    // The default is MIXED_DELAY_LINEAR.
+    MIXED_DELAY_INTERPOLATION,
   };
 
   // This enum descripbes the possible resampling quality options.
@@ -313,7 +500,10 @@ extern "C" {
     MIXED_SINE = 1,
     MIXED_SQUARE,
     MIXED_TRIANGLE,
-    MIXED_SAWTOOTH
+    MIXED_SAWTOOTH,
+    // A sum of sines at multiples of the frequency. See
+    // MIXED_GENERATOR_PARTIALS.
+    MIXED_ADDITIVE
   };
 
   // This enum describes the possible noise types.
@@ -335,6 +525,56 @@ extern "C" {
     MIXED_PASS_HIGH
   };
 
+  // This enum describes the possible pitch shifting algorithms.
+  MIXED_EXPORT enum mixed_pitch_algorithm{
+    // A phase vocoder. High quality, but with a latency of
+    // about 46ms at 44.1kHz and a high CPU cost.
+    MIXED_PITCH_VOCODER = 1,
+    // Time-domain waveform similarity overlap-add. Lower
+    // quality, especially for polyphonic material, but with
+    // a latency of 5ms to 9ms and a low CPU cost. Suited for
+    // voices. The pitch is limited to [0.5, 2.0].
+    MIXED_PITCH_WSOLA
+  };
+
+  // This enum describes the outputs of the state variable filter.
+  MIXED_EXPORT enum mixed_svf_output{
+    MIXED_SVF_LOW = 0,
+    MIXED_SVF_HIGH,
+    MIXED_SVF_BAND,
+    MIXED_SVF_NOTCH
+  };
+
+  // This enum describes how the gate measures the input level.
+  MIXED_EXPORT enum mixed_gate_detector{
+    // The highest absolute sample value.
+    MIXED_GATE_PEAK = 1,
+    // The root mean square, which follows the perceived loudness
+    // more closely and ignores isolated clicks.
+    MIXED_GATE_RMS
+  };
+
+  // This enum describes how a delay line reads between samples.
+  MIXED_EXPORT enum mixed_delay_interpolation{
+    // Cheap, but dulls high frequencies for fractional delays.
+    MIXED_DELAY_LINEAR = 1,
+    // Keeps the frequency response flat, but smears changes of the
+    // delay over a few samples, so it suits slow modulation best.
+    MIXED_DELAY_ALLPASS,
+    // A four point Hermite curve, which is flatter than linear and
+    // follows fast modulation. The delay is at least one sample.
+    MIXED_DELAY_CUBIC
+  };
+
+  // This enum describes the possible filters of an equalizer band.
+  MIXED_EXPORT enum mixed_equalizer_filter{
+    MIXED_EQUALIZER_PEAK = 1,
+    MIXED_EQUALIZER_LOW_SHELF,
+    MIXED_EQUALIZER_HIGH_SHELF,
+    MIXED_EQUALIZER_LOW_PASS,
+    MIXED_EQUALIZER_HIGH_PASS
+  };
+
   // This enum holds property flags for segments.
   MIXED_EXPORT enum mixed_segment_info_flags{
     // This means that the segment's output and input
@@ -406,6 +646,11 @@ extern "C" {
     MIXED_ENCODING_ENUM,
     MIXED_ERROR_ENUM,
     MIXED_RESAMPLE_TYPE_ENUM,
+    MIXED_PITCH_ALGORITHM_ENUM,
+    MIXED_EQUALIZER_BAND_POINTER,
+    MIXED_GATE_DETECTOR_ENUM,
+    MIXED_GENERATOR_PARTIAL_POINTER,
+    MIXED_DELAY_INTERPOLATION_ENUM,
   };
 
   // An internal audio data buffer.
@@ -441,6 +686,31 @@ extern "C" {
     size_t samplerate;
   };
 
+  // Parameters of a single band of an equalizer segment.
+  MIXED_EXPORT struct mixed_equalizer_band{
+    // The index of the band within the equalizer.
+    size_t index;
+    // The kind of filter the band applies.
+    enum mixed_equalizer_filter filter;
+    // The center or cutoff frequency in Hz.
+    float frequency;
+    // The boost or cut in dB. Ignored by the pass filters.
+    float gain;
+    // The quality factor, which determines the bandwidth.
+    float q;
+  };
+
+  // Parameters of a single partial of an additive generator.
+  MIXED_EXPORT struct mixed_generator_partial{
+    // The index of the partial within the generator.
+    size_t index;
+    // The frequency of the partial relative to that of the generator.
+    // Partials above the nyquist frequency are left out.
+    float ratio;
+    // The amplitude of the partial.
+    float amplitude;
+  };
+
   // Metadata struct for a segment's field.
   //
   // This struct can be used to figure out what kind of
@@ -801,6 +1071,11 @@ extern "C" {
   // frequency and wave form type. You may change the frequency and
   // wave form type at any time. Potentially this could be used to
   // create a very primitive synthesizer.
+  //
+  // The square, triangle, and sawtooth waves are band-limited, so
+  // they do not alias at high frequencies. The additive type sums up
+  // any number of sine partials, which are configured through the
+  // MIXED_GENERATOR_PARTIALS and MIXED_GENERATOR_PARTIAL fields.
   MIXED_EXPORT int mixed_make_segment_generator(enum mixed_generator_type type, size_t frequency, size_t samplerate, struct mixed_segment *segment);
 
   // A LADSPA plugin segment
@@ -856,11 +1131,12 @@ extern "C" {
   // This segment is capable of mixing sources according to their position
   // and movement in space. It thus simulates the behaviour of sound in a
   // 3D environment. This segment takes an arbitrary number of mono inputs
-  // and has two outputs (left and right). Each input has two additional
-  // fields aside from the buffer:
+  // and has two outputs (left and right) per listener. Each input has three
+  // additional fields aside from the buffer:
   //
   // * MIXED_SPACE_LOCATION
   // * MIXED_SPACE_VELOCITY
+  // * MIXED_SPACE_PRIORITY
   //
   // The position, velocity, and general properties of the space mixing
   // are configured through the general field set/get functions. The
@@ -876,6 +1152,47 @@ extern "C" {
   // * MIXED_SPACE_MAX_DISTANCE
   // * MIXED_SPACE_ROLLOFF
   // * MIXED_SPACE_ATTENUATION
+  // * MIXED_SPACE_MAX_VOICES
+  // * MIXED_SPACE_REAL_VOICES
+  // * MIXED_SPACE_VIRTUAL_VOICES
+  // * MIXED_SPACE_GRID_SIZE
+  // * MIXED_SPACE_AMBISONIC_ORDER
+  // * MIXED_PITCH_FRAMESIZE
+  // * MIXED_PITCH_OVERSAMPLING
+  // * MIXED_FAST_MATH
+  // * MIXED_LATENCY
+  //
+  // Sources that are out of range or too quiet to be heard, as well as
+  // sources beyond the MIXED_SPACE_MAX_VOICES limit, become "virtual".
+  // Their source segment is still mixed to keep their position in time,
+  // but they are not processed any further. Voices fade in and out over
+  // one mix when they switch between being virtual and real.
+  //
+  // If you have a very large number of mostly static sources, of which
+  // only few are in range at any time, set MIXED_SPACE_GRID_SIZE to
+  // roughly the maximal distance to avoid computing the distance and
+  // volume of every source. Sources out of range still count as virtual
+  // and their source segments are still mixed, so they resume where
+  // they would have been when they come back into range.
+  //
+  // Up to eight listeners can be rendered from the same set of sources,
+  // for instance for split-screen views. Listener N has the outputs 2N
+  // (left) and 2N+1 (right), and is created by setting a buffer on one
+  // of them. Its location, velocity, direction, and up vector are then
+  // accessed with mixed_segment_set_out/get_out on either of its outputs.
+  // The segment-wide fields of the same names refer to the first
+  // listener. Each source segment is only mixed once per mix, regardless
+  // of the number of listeners. A listener is only rendered if both of
+  // its outputs have a buffer, and trailing listeners without any
+  // buffers are removed again.
+  //
+  // With MIXED_SPACE_AMBISONIC_ORDER set, each listener collects its
+  // sources in an ambisonic bus (ACN channel order, SN3D normalisation)
+  // that is decoded to a ring of eight virtual speakers around the
+  // listener plus one above and one below, which are then panned to
+  // its outputs. The listener's orientation only enters the decoder, so
+  // turning the listener costs nothing per source. The decoding gains
+  // are ramped over each mix, so turning the listener does not click.
   //
   // See the MIXED_FIELDS enum for the documentation of each field.
   // This segment does allow you to change fields and buffers while the
@@ -893,6 +1210,17 @@ extern "C" {
   // memory, so watch out for that.
   MIXED_EXPORT int mixed_make_segment_delay(float time, size_t samplerate, struct mixed_segment *segment);
 
+  // A modulated delay line segment
+  //
+  // Unlike the delay segment, the delay time may be any fraction of a
+  // sample and can be changed while mixing without reallocation or
+  // clicks, up to the maximal time given here. Changes to
+  // MIXED_DELAY_TIME are ramped over the next mix. If a buffer is
+  // attached to input 1, it is read as the delay time in seconds for
+  // every sample instead. Modulating the delay with a slow generator
+  // gives chorus, flanger, and vibrato effects.
+  MIXED_EXPORT int mixed_make_segment_delay_line(float max_time, size_t samplerate, struct mixed_segment *segment);
+
   // A repeat segment
   //
   // This segment allows you to repeat some input from a buffer, and then
@@ -909,6 +1237,18 @@ extern "C" {
   // amount. The pitch should be a float in the range ]0, infty[, where 1.0
   // means no change in pitch, 0.5 means half the pitch, 2.0 means double the
   // pitch and so on.
+  //
+  // The algorithm used can be changed with MIXED_PITCH_ALGORITHM. The
+  // phase vocoder can be tuned with MIXED_PITCH_FRAMESIZE and
+  // MIXED_PITCH_OVERSAMPLING, which may be changed while mixing: the
+  // previous configuration keeps running until the new one produces
+  // output, and is then crossfaded out. The two are lined up for the
+  // crossfade, so a configuration with a lower latency stays delayed
+  // to match the previous one, and the latency never drops while
+  // mixing. A configuration with a higher latency instead leaves a gap
+  // of silence as long as the difference, with short fades at either
+  // end. Changes made before anything was mixed take effect at once.
+  // MIXED_LATENCY reports the resulting delay.
   MIXED_EXPORT int mixed_make_segment_pitch(float pitch, size_t samplerate, struct mixed_segment *segment);
 
   // A noise gate segment
@@ -919,11 +1259,17 @@ extern "C" {
   // If the volume then ever goes below the close threshold, the gate stays
   // open for the duration of the hold time, after which it goes through a
   // linear fade out for the duration of the release time.
+  //
+  // The level is measured over windows of 32 samples, either as the peak
+  // or as the RMS, so the gate reacts with a granularity of below a
+  // millisecond at common samplerates.
   MIXED_EXPORT int mixed_make_segment_gate(size_t samplerate, struct mixed_segment *segment);
 
   // A noise generator segment.
   //
-  // This segment can generate white, pink, and brown noise.
+  // This segment can generate white, pink, and brown noise. Every
+  // noise segment has its own random number generator, so segments
+  // may be mixed on separate threads.
   MIXED_EXPORT int mixed_make_segment_noise(enum mixed_noise_type type, struct mixed_segment *segment);
 
   // A frequency filter segment.
@@ -931,8 +1277,78 @@ extern "C" {
   // The cutoff cannot be larger than the samplerate. Generally, if the cutoff
   // frequency is larger than half of the samplerate, major distortion will
   // occur, so tread carefully.
+  //
+  // The filter is a second-order Butterworth low or high pass. Through
+  // MIXED_CHANNELS it can filter several channels at once, which is
+  // considerably cheaper than using one segment per channel.
   MIXED_EXPORT int mixed_make_segment_frequency_pass(enum mixed_frequency_pass pass, size_t cutoff, size_t samplerate, struct mixed_segment *segment);
 
+  // A state variable filter segment.
+  //
+  // The low, high, band pass and notch responses are computed together
+  // and placed in the outputs described by mixed_svf_output. Unlike the
+  // frequency pass segment, the cutoff can be changed at any time
+  // without clicks. If a buffer is attached to input 1, it is read as
+  // the cutoff in Hz for every sample, which allows filter sweeps
+  // driven by other segments, such as a generator.
+  MIXED_EXPORT int mixed_make_segment_svf(float cutoff, size_t samplerate, struct mixed_segment *segment);
+
+  // A parametric equalizer segment.
+  //
+  // Up to 16 peaking, shelving, or pass bands are applied to every
+  // channel in a single pass over the audio, which is much cheaper than
+  // chaining filter segments. Input and output N belong to channel N.
+  // The bands are configured through MIXED_EQUALIZER_BANDS and
+  // MIXED_EQUALIZER_BAND.
+  MIXED_EXPORT int mixed_make_segment_equalizer(size_t channels, size_t samplerate, struct mixed_segment *segment);
+
+  // A crossover segment.
+  //
+  // Splits the input into 2 to 5 frequency bands with fourth order
+  // Linkwitz-Riley filters, as needed for multiband processing or to
+  // drive separate speakers. Output 0 receives the lowest band. The
+  // bands stay in phase with each other, so that they sum back up to
+  // the input with a flat frequency response.
+  MIXED_EXPORT int mixed_make_segment_crossover(size_t bands, size_t samplerate, struct mixed_segment *segment);
+
+  // A convolution segment.
+  //
+  // Convolves the input with the given impulse response of length
+  // samples, as is commonly used for reverbs. The response is copied,
+  // and segments with identical responses and partition sizes share
+  // one copy of its spectra. The processing is done in partitions of
+  // the given size, which must be a power of two, and delays the
+  // output by one partition. The cost is independent of the block
+  // size and grows linearly with the length of the response.
+  MIXED_EXPORT int mixed_make_segment_convolution(float *ir, size_t length, size_t partition, struct mixed_segment *segment);
+
+  // A reverb segment.
+  //
+  // Simulates a room through a feedback delay network, a set of delay
+  // lines whose outputs are damped and mixed back into each other. The
+  // cost per sample is constant and small, which makes it suitable for
+  // many rooms at once, where a convolution would be too expensive.
+  MIXED_EXPORT int mixed_make_segment_reverb(size_t samplerate, struct mixed_segment *segment);
+
+  // A compressor segment.
+  //
+  // Reduces the level of all channels together whenever the peak of
+  // any of them exceeds the threshold. The peak is detected ahead of
+  // time by delaying the output by the lookahead, so that the gain can
+  // be lowered smoothly before the peak arrives. With the default
+  // infinite ratio, this acts as a brickwall limiter, which can be put
+  // in front of a packer to keep the integer output from overflowing.
+  MIXED_EXPORT int mixed_make_segment_compressor(size_t channels, size_t samplerate, struct mixed_segment *segment);
+
+  // A ducking segment.
+  //
+  // Input 0 is the key, and inputs 1 to programs are passed through to
+  // outputs 0 to programs-1. While the key is louder than the threshold,
+  // the volume of all programs is lowered, as is commonly done to keep
+  // dialogue intelligible over music and effects. The key is evaluated
+  // once per mix, so the reaction time is bounded by the block size.
+  MIXED_EXPORT int mixed_make_segment_ducker(size_t programs, size_t samplerate, struct mixed_segment *segment);
+
   // A queue segment for inner segments.
   //
   // The queue will delegate mixing to the first segment in its list until that
@@ -18,269 +18,366 @@
 
 #include "internal.h"
 
-void fft(float *fftBuffer, long framesize, long sign){
-  float wr, wi, arg, *p1, *p2, temp;
-  float tr, ti, ur, ui, *p1r, *p1i, *p2r, *p2i;
-  long i, bitm, j, le, le2, k;
-
-  for (i = 2; i < 2*framesize-2; i += 2) {
-    for (bitm = 2, j = 0; bitm < 2*framesize; bitm <<= 1) {
-      if (i & bitm) j++;
-      j <<= 1;
-    }
-    if (i < j) {
-      p1 = fftBuffer+i; p2 = fftBuffer+j;
-      temp = *p1; *(p1++) = *p2;
-      *(p2++) = temp; temp = *p1;
-      *p1 = *p2; *p2 = temp;
-    }
-  }
-  for (k = 0, le = 2; k < (long)(log(framesize)/log(2.)+.5); k++) {
-    le <<= 1;
-    le2 = le>>1;
-    ur = 1.0;
-    ui = 0.0;
-    arg = M_PI / (le2>>1);
-    wr = cos(arg);
-    wi = sign*sin(arg);
-    for (j = 0; j < le2; j += 2) {
-      p1r = fftBuffer+j; p1i = p1r+1;
-      p2r = p1r+le2; p2i = p2r+1;
-      for (i = j; i < 2*framesize; i += le) {
-        tr = *p2r * ur - *p2i * ui;
-        ti = *p2r * ui + *p2i * ur;
-        *p2r = *p1r - tr; *p2i = *p1i - ti;
-        *p1r += tr; *p1i += ti;
-        p1r += le; p1i += le;
-        p2r += le; p2i += le;
-      }
-      tr = ur*wr - ui*wi;
-      ui = ur*wi + ui*wr;
-      ur = tr;
-    }
-  }
-}
+// Mixed in chunks of this many samples while crossfading.
+#define TRANSITION_CHUNK 256
+// The bins of a windowed partial are resynthesised with independent
+// phases, which loses about a third of its level.
+#define VOCODER_GAIN 1.5
+// The per-bin arrays are padded to a multiple of this many bins, so
+// that the loops over them need no remainder and are vectorized.
+#define VOCODER_LANES 8
 
-void free_pitch_data(struct pitch_data *data){
-  if(data->in_fifo)
-    free(data->in_fifo);
-  data->in_fifo = 0;
+static void vocoder_stage(float *spectrum, struct stft_data *stft, void *user);
 
-  if(data->out_fifo)
-    free(data->out_fifo);
-  data->out_fifo = 0;
+void free_pitch_data(struct pitch_data *data){
+  free_stft_data(&data->stft);
+  free_ring_data(&data->delay);
+  free_ring_data(&data->lag);
 
-  if(data->fft_workspace)
-    free(data->fft_workspace);
-  data->fft_workspace = 0;
+  if(data->previous){
+    free_pitch_data(data->previous);
+    free(data->previous);
+  }
+  data->previous = 0;
 
-  if(data->last_phase)
-    free(data->last_phase);
+  // All per-instance arrays are carved out of one allocation.
+  if(data->real)
+    free(data->real);
+  data->real = 0;
+  data->imag = 0;
   data->last_phase = 0;
-
-  if(data->phase_sum)
-    free(data->phase_sum);
   data->phase_sum = 0;
-
-  if(data->output_accumulator)
-    free(data->output_accumulator);
-  data->output_accumulator = 0;
-
-  if(data->analyzed_frequency)
-    free(data->analyzed_frequency);
   data->analyzed_frequency = 0;
-
-  if(data->analyzed_magnitude)
-    free(data->analyzed_magnitude);
   data->analyzed_magnitude = 0;
-
-  if(data->synthesized_frequency)
-    free(data->synthesized_frequency);
   data->synthesized_frequency = 0;
-
-  if(data->synthesized_magnitude)
-    free(data->synthesized_magnitude);
   data->synthesized_magnitude = 0;
 }
 
+// The stage refers back to the data, so it has to be updated whenever
+// the data is moved.
+static void bind_pitch_stage(struct pitch_data *data){
+  data->stage.process = vocoder_stage;
+  data->stage.user = data;
+  if(data->stft.stages.count)
+    data->stft.stages.data[0] = &data->stage;
+}
+
 int make_pitch_data(size_t framesize, size_t oversampling, size_t samplerate, struct pitch_data *data){
-  // FIXME: determine which of these can be static and which actually
-  //        need to be retained for processing over contiguous buffers
-  data->in_fifo = calloc(framesize, sizeof(float));
-  data->out_fifo = calloc(framesize, sizeof(float));
-  data->fft_workspace = calloc(framesize*2, sizeof(float));
-  data->last_phase = calloc(framesize/2+1, sizeof(float));
-  data->phase_sum = calloc(framesize/2+1, sizeof(float));
-  data->output_accumulator = calloc(framesize*2, sizeof(float));
-  data->analyzed_frequency = calloc(framesize, sizeof(float));
-  data->analyzed_magnitude = calloc(framesize, sizeof(float));
-  data->synthesized_frequency = calloc(framesize, sizeof(float));
-  data->synthesized_magnitude = calloc(framesize, sizeof(float));
-
-  if(!data->in_fifo ||
-     !data->out_fifo ||
-     !data->fft_workspace ||
-     !data->last_phase ||
-     !data->phase_sum ||
-     !data->output_accumulator ||
-     !data->analyzed_frequency ||
-     !data->analyzed_magnitude ||
-     !data->synthesized_frequency ||
-     !data->synthesized_magnitude){
+  size_t bins = (framesize/2+VOCODER_LANES) & ~(size_t)(VOCODER_LANES-1);
+  if(!make_stft_data(framesize, oversampling, &data->stft)){
+    return 0;
+  }
+
+  float *memory = calloc(bins*8, sizeof(float));
+  if(!memory){
     mixed_err(MIXED_OUT_OF_MEMORY);
-    free_pitch_data(data);
+    free_stft_data(&data->stft);
     return 0;
   }
 
+  data->real = memory; memory += bins;
+  data->imag = memory; memory += bins;
+  data->last_phase = memory; memory += bins;
+  data->phase_sum = memory; memory += bins;
+  data->analyzed_frequency = memory; memory += bins;
+  data->analyzed_magnitude = memory; memory += bins;
+  data->synthesized_frequency = memory; memory += bins;
+  data->synthesized_magnitude = memory; memory += bins;
+
+  bind_pitch_stage(data);
+  if(!stft_add_stage(&data->stage, &data->stft)){
+    free(data->real);
+    data->real = 0;
+    free_stft_data(&data->stft);
+    return 0;
+  }
+
+  data->pitch = 1.0;
   data->framesize = framesize;
   data->oversampling = oversampling;
   data->samplerate = samplerate;
+  memset(&data->delay, 0, sizeof(struct ring_data));
+  memset(&data->lag, 0, sizeof(struct ring_data));
+  data->previous = 0;
+  data->transition = 0;
+  data->started = 0;
+  data->fast_math = 1;
 
   return 1;
 }
 
-void pitch_shift(float pitch, float *in, float *out, size_t samples, struct pitch_data *data){
-  size_t framesize = data->framesize;
-  size_t oversampling = data->oversampling;
-  float *in_fifo = data->in_fifo;
-  float *out_fifo = data->out_fifo;
-  float *fft_workspace = data->fft_workspace;
-  float *last_phase = data->last_phase;
-  float *phase_sum = data->phase_sum;
-  float *output_accumulator = data->output_accumulator;
-  float *analyzed_frequency = data->analyzed_frequency;
-  float *analyzed_magnitude = data->analyzed_magnitude;
-  float *synthesized_frequency = data->synthesized_frequency;
-  float *synthesized_magnitude = data->synthesized_magnitude;
-  double magnitude, phase, tmp, window, real, imag;
-  long i, k, qpd, index;
-  
-  /* set up some handy variables */
-  long framesize2 = framesize/2;
-  long step = framesize/oversampling;
-  double bin_frequencies = (double)data->samplerate/(double)framesize;
-  double expected = 2.*M_PI*(double)step/(double)framesize;
-  long fifo_latency = framesize-step;
-  if (data->overlap == 0) data->overlap = fifo_latency;
-
-  /* main processing loop */
-  for (i = 0; i < samples; i++){
-
-    /* As long as we have not yet collected enough data just read in */
-    in_fifo[data->overlap] = in[i];
-    out[i] = out_fifo[data->overlap-fifo_latency];
-    data->overlap++;
-
-    /* now we have enough data for processing */
-    if (data->overlap >= framesize) {
-      data->overlap = fifo_latency;
-
-      /* do windowing and re,im interleave */
-      for (k = 0; k < framesize;k++) {
-        window = -.5*cos(2.*M_PI*(double)k/(double)framesize)+.5;
-        fft_workspace[2*k] = in_fifo[k] * window;
-        fft_workspace[2*k+1] = 0.;
-      }
-
-      /* ***************** ANALYSIS ******************* */
-      /* do transform */
-      fft(fft_workspace, framesize, -1);
-
-      /* this is the analysis step */
-      for (k = 0; k <= framesize2; k++) {
-
-        /* de-interlace FFT buffer */
-        real = fft_workspace[2*k];
-        imag = fft_workspace[2*k+1];
+// Whether any output of the configuration may have been heard yet.
+static bool pitch_audible(struct pitch_data *data){
+  if(data->previous)
+    return pitch_latency(data) <= data->transition;
+  return data->started;
+}
 
-        /* compute magnitudeitude and phase */
-        magnitude = 2.*sqrt(real*real + imag*imag);
-        phase = atan2(imag,real);
+int prepare_pitch_data(size_t framesize, size_t oversampling, size_t samplerate, struct pitch_data *data, struct pitch_data *next){
+  // A configuration that has not been heard yet is simply dropped, and
+  // the switch is made from the one before it, if any.
+  struct pitch_data *from = pitch_audible(data)? data : data->previous;
+  if(!make_pitch_data(framesize, oversampling, samplerate, next)){
+    return 0;
+  }
+  next->fast_math = data->fast_math;
+  if(from){
+    // Whichever configuration has the lower latency is held back by the
+    // difference, so that both line up while they are crossfaded.
+    size_t latency = pitch_latency(from);
+    size_t target = stft_latency(&next->stft);
+    if(!make_ring_data((target < latency)? latency-target : 0, &next->delay) ||
+       !make_ring_data((latency < target)? target-latency : 0, &next->lag)){
+      free_pitch_data(next);
+      return 0;
+    }
+  }
+  // The current configuration will be moved here.
+  if(from == data){
+    next->previous = calloc(1, sizeof(struct pitch_data));
+    if(!next->previous){
+      mixed_err(MIXED_OUT_OF_MEMORY);
+      free_pitch_data(next);
+      return 0;
+    }
+  }
+  return 1;
+}
 
-        /* compute phase difference */
-        tmp = phase - last_phase[k];
-        last_phase[k] = phase;
+void commit_pitch_data(struct pitch_data *next, struct pitch_data *data){
+  struct pitch_data *previous = next->previous;
+  if(previous){
+    // An unfinished transition is cut short.
+    if(data->previous){
+      free_pitch_data(data->previous);
+      free(data->previous);
+      data->previous = 0;
+    }
+    free_ring_data(&data->lag);
+    *previous = *data;
+    bind_pitch_stage(previous);
+  }else{
+    previous = data->previous;
+    data->previous = 0;
+    free_pitch_data(data);
+  }
+  *data = *next;
+  bind_pitch_stage(data);
+  data->previous = previous;
+}
 
-        /* subtract expected phase difference */
-        tmp -= (double)k*expected;
+int reconfigure_pitch_data(size_t framesize, size_t oversampling, size_t samplerate, struct pitch_data *data){
+  struct pitch_data next;
+  if(!prepare_pitch_data(framesize, oversampling, samplerate, data, &next)){
+    return 0;
+  }
+  commit_pitch_data(&next, data);
+  return 1;
+}
 
-        /* map delta phase into +/- Pi interval */
-        qpd = tmp/M_PI;
-        if (qpd >= 0) qpd += qpd&1;
-        else qpd -= qpd&1;
-        tmp -= M_PI*(double)qpd;
+void pitch_fast_math(bool fast_math, struct pitch_data *data){
+  data->fast_math = fast_math;
+  if(data->previous)
+    data->previous->fast_math = fast_math;
+}
 
-        /* get deviation from bin frequency from the +/- Pi interval */
-        tmp = oversampling*tmp/(2.*M_PI);
+size_t pitch_latency(struct pitch_data *data){
+  return stft_latency(&data->stft) + data->delay.size;
+}
 
-        /* compute the k-th partials' true frequency */
-        tmp = (double)k*bin_frequencies + tmp*bin_frequencies;
+// The analysis and synthesis loops run over every bin of every frame,
+// so by default they use the float approximations from fastmath.h
+// rather than libm calls. The spectrum is split into separate real and
+// imaginary arrays first, and the loops run over the padded arrays, so
+// that they have no strides or remainders and are vectorized even at
+// -O2. Compared to evaluating the loops in double precision, the
+// shifted output deviates by less than 3e-4 of full scale either way,
+// as checked by test/vocoder.c.
+// The choice between the two is made outside of the loops that call
+// them, so that the fast ones are not held back by a branch.
+
+// Computes the true frequency of each bin from its phase difference
+// to the last frame.
+static void vocoder_analyze(const float *restrict real, const float *restrict imag, float *restrict last_phase, float *restrict frequency, int bins, struct stft_data *stft, float bin_frequencies, bool fast_math){
+  long oversampling = stft->oversampling;
+  int step = stft->framesize/oversampling;
+  /* the expected phase advance of bin k is k*step/framesize turns,
+     which the framesize being a power of two lets us wrap exactly */
+  int mask = stft->framesize-1;
+  float expected = 2.f*(float)M_PI/(float)stft->framesize;
+  float phase, tmp;
+
+  /* the phases are gathered in the frequency array first */
+  if (fast_math) {
+    for (int k = 0; k < bins; k++) frequency[k] = fast_atan2(imag[k], real[k]);
+  } else {
+    for (int k = 0; k < bins; k++) frequency[k] = atan2f(imag[k], real[k]);
+  }
 
-        /* store magnitudeitude and true frequency in analysis arrays */
-        analyzed_magnitude[k] = magnitude;
-        analyzed_frequency[k] = tmp;
+  for (int k = 0; k < bins; k++) {
 
-      }
+    /* compute phase difference */
+    phase = frequency[k];
+    tmp = phase - last_phase[k];
+    last_phase[k] = phase;
 
-      /* ***************** PROCESSING ******************* */
-      /* this does the actual pitch shifting */
-      memset(synthesized_magnitude, 0, framesize*sizeof(float));
-      memset(synthesized_frequency, 0, framesize*sizeof(float));
-      for (k = 0; k <= framesize2; k++) { 
-        index = k*pitch;
-        if (index <= framesize2) { 
-          synthesized_magnitude[index] += analyzed_magnitude[k]; 
-          synthesized_frequency[index] = analyzed_frequency[k] * pitch; 
-        } 
-      }
-			
-      /* ***************** SYNTHESIS ******************* */
-      /* this is the synthesis step */
-      for (k = 0; k <= framesize2; k++) {
+    /* subtract expected phase difference and map into +/- Pi */
+    tmp = wrap_phase(tmp - expected*((k*step) & mask));
 
-        /* get magnitudeitude and true frequency from synthesis arrays */
-        magnitude = synthesized_magnitude[k];
-        tmp = synthesized_frequency[k];
+    /* compute the k-th partials' true frequency from the deviation */
+    frequency[k] = ((float)k + tmp*oversampling/(2.f*(float)M_PI)) * bin_frequencies;
+  }
+}
 
-        /* subtract bin mid frequency */
-        tmp -= (double)k*bin_frequencies;
+// Accumulates the phase of each bin from its frequency and turns it
+// back into a complex value.
+static void vocoder_synthesize(const float *restrict frequency, const float *restrict magnitude, float *restrict phase_sum, float *restrict real, float *restrict imag, int bins, struct stft_data *stft, float bin_frequencies, bool fast_math){
+  long oversampling = stft->oversampling;
+  int step = stft->framesize/oversampling;
+  int mask = stft->framesize-1;
+  float expected = 2.f*(float)M_PI/(float)stft->framesize;
+  float phase, tmp;
+
+  for (int k = 0; k < bins; k++) {
+
+    /* get bin deviation from the true frequency, take oversampling
+       into account and add the overlap phase advance back in */
+    tmp = (frequency[k]/bin_frequencies - (float)k) * (2.f*(float)M_PI/oversampling);
+    tmp += expected*((k*step) & mask);
+
+    /* accumulate delta phase to get bin phase, keeping it small so
+       it does not lose precision */
+    phase = wrap_phase(phase_sum[k] + tmp);
+    phase_sum[k] = phase;
+  }
 
-        /* get bin deviation from freq deviation */
-        tmp /= bin_frequencies;
+  /* get real and imag part */
+  if (fast_math) {
+    for (int k = 0; k < bins; k++) {
+      float s, c;
+      fast_sincos(phase_sum[k], &s, &c);
+      real[k] = magnitude[k]*c;
+      imag[k] = magnitude[k]*s;
+    }
+  } else {
+    for (int k = 0; k < bins; k++) {
+      real[k] = magnitude[k]*cosf(phase_sum[k]);
+      imag[k] = magnitude[k]*sinf(phase_sum[k]);
+    }
+  }
+}
 
-        /* take oversampling into account */
-        tmp = 2.*M_PI*tmp/oversampling;
+static void vocoder_stage(float *spectrum, struct stft_data *stft, void *user){
+  struct pitch_data *data = (struct pitch_data *)user;
+  float pitch = data->pitch;
+  float *real = data->real;
+  float *imag = data->imag;
+  float *analyzed_frequency = data->analyzed_frequency;
+  float *analyzed_magnitude = data->analyzed_magnitude;
+  float *synthesized_frequency = data->synthesized_frequency;
+  float *synthesized_magnitude = data->synthesized_magnitude;
+  long index;
+  int k;
+  
+  /* set up some handy variables */
+  long framesize2 = stft->framesize/2;
+  int bins = (framesize2+VOCODER_LANES) & ~(VOCODER_LANES-1);
+  float bin_frequencies = (float)data->samplerate/(float)stft->framesize;
+
+  /* de-interlace FFT buffer, leaving the padding silent */
+  for (k = 0; k <= framesize2; k++) {
+    real[k] = spectrum[2*k];
+    imag[k] = spectrum[2*k+1];
+  }
 
-        /* add the overlap phase advance back in */
-        tmp += (double)k*expected;
+  /* ***************** ANALYSIS ******************* */
+  /* this is the analysis step */
+  vocoder_analyze(real, imag, data->last_phase, analyzed_frequency, bins, stft, bin_frequencies, data->fast_math);
 
-        /* accumulate delta phase to get bin phase */
-        phase_sum[k] += tmp;
-        phase = phase_sum[k];
+  /* compute magnitudes separately, as sqrtf keeps the loop scalar */
+  for (k = 0; k <= framesize2; k++) {
+    analyzed_magnitude[k] = VOCODER_GAIN*sqrtf(real[k]*real[k] + imag[k]*imag[k]);
+  }
 
-        /* get real and imag part and re-interleave */
-        fft_workspace[2*k] = magnitude*cos(phase);
-        fft_workspace[2*k+1] = magnitude*sin(phase);
-      } 
+  /* ***************** PROCESSING ******************* */
+  /* this does the actual pitch shifting */
+  memset(synthesized_magnitude, 0, bins*sizeof(float));
+  memset(synthesized_frequency, 0, bins*sizeof(float));
+  for (k = 0; k <= framesize2; k++) { 
+    index = k*pitch;
+    if (index <= framesize2) { 
+      synthesized_magnitude[index] += analyzed_magnitude[k]; 
+      synthesized_frequency[index] = analyzed_frequency[k] * pitch; 
+    } 
+  }
+			
+  /* ***************** SYNTHESIS ******************* */
+  /* this is the synthesis step */
+  vocoder_synthesize(synthesized_frequency, synthesized_magnitude, data->phase_sum, real, imag, bins, stft, bin_frequencies, data->fast_math);
+
+  /* re-interleave */
+  for (k = 0; k <= framesize2; k++) {
+    spectrum[2*k] = real[k];
+    spectrum[2*k+1] = imag[k];
+  }
+}
 
-      /* zero negative frequencies */
-      for (k = framesize+2; k < 2*framesize; k++) fft_workspace[k] = 0.;
+static void vocoder_shift(float pitch, float *in, float *out, size_t samples, struct pitch_data *data){
+  data->pitch = pitch;
+  stft_process(in, out, samples, &data->stft);
+  ring_exchange(out, out, samples, &data->delay);
+  data->started = 1;
+}
 
-      /* do inverse transform */
-      fft(fft_workspace, framesize, 1);
+static inline float fade_weight(float x){
+  return (x < 0.0)? 0.0 : ((1.0 < x)? 1.0 : x);
+}
 
-      /* do windowing and add to output accumulator */ 
-      for(k=0; k < framesize; k++) {
-        window = -.5*cos(2.*M_PI*(double)k/(double)framesize)+.5;
-        output_accumulator[k] += 2.*window*fft_workspace[2*k]/(framesize2*oversampling);
+// While a reconfiguration is pending, the previous configuration keeps
+// running until the new one has filled its latency, and is then
+// crossfaded over one step of the new one. The two are lined up first,
+// as they would otherwise comb filter while crossfading. If the new one
+// has the lower latency, it simply stays held back by the difference.
+// If it has the higher latency, the previous output is held back by the
+// difference as well, which leaves a gap of silence in the output, with
+// short fades at its edges.
+void pitch_shift(float pitch, float *in, float *out, size_t samples, struct pitch_data *data){
+  struct pitch_data *previous = data->previous;
+  float shifted[TRANSITION_CHUNK];
+  float held[TRANSITION_CHUNK];
+  size_t i = 0;
+
+  if(previous){
+    float latency = pitch_latency(data);
+    float fade = data->framesize/data->oversampling;
+    float lag = data->lag.size;
+    float edge = (lag < fade)? lag : fade;
+    while(i < samples){
+      size_t chunk = smin(samples-i, TRANSITION_CHUNK);
+      // The new one goes first, as the output may be the input.
+      vocoder_shift(pitch, in+i, shifted, chunk, data);
+      vocoder_shift(pitch, in+i, out+i, chunk, previous);
+      if(0 < lag){
+        ring_exchange(out+i, held, chunk, &data->lag);
+        for(size_t j=0; j<chunk; ++j){
+          float t = data->transition + j;
+          out[i+j] = fade_weight(1.0 - t/edge)*out[i+j] + fade_weight((t - lag)/edge)*held[j];
+        }
+      }
+      for(size_t j=0; j<chunk; ++j){
+        float weight = fade_weight((data->transition + j - latency) / fade);
+        out[i+j] += weight*(shifted[j] - out[i+j]);
+      }
+      data->transition += chunk;
+      i += chunk;
+      if(latency + fade <= data->transition){
+        free_pitch_data(previous);
+        free(previous);
+        free_ring_data(&data->lag);
+        data->previous = 0;
+        break;
       }
-      for (k = 0; k < step; k++) out_fifo[k] = output_accumulator[k];
-
-      /* shift accumulator */
-      memmove(output_accumulator, output_accumulator+step, framesize*sizeof(float));
-
-      /* move input FIFO */
-      for (k = 0; k < fifo_latency; k++) in_fifo[k] = in_fifo[k+step];
     }
   }
+  vocoder_shift(pitch, in+i, out+i, samples-i, data);
 }
@@ -0,0 +1,103 @@
+#include "internal.h"
+
+// A block that runs past the end of the ring wraps around to its start,
+// so it is made up of at most two contiguous spans, or more if the
+// block is longer than the ring itself. Each span is moved with memcpy
+// rather than sample by sample with a modulo.
+
+#define RING_SWAP 256
+
+void free_ring_data(struct ring_data *data){
+  if(data->data)
+    free(data->data);
+  data->data = 0;
+  data->size = 0;
+  data->index = 0;
+}
+
+int make_ring_data(size_t size, struct ring_data *data){
+  float *samples = 0;
+  if(0 < size){
+    samples = calloc(size, sizeof(float));
+    if(!samples){
+      mixed_err(MIXED_OUT_OF_MEMORY);
+      return 0;
+    }
+  }
+  free_ring_data(data);
+  data->data = samples;
+  data->size = size;
+  return 1;
+}
+
+void ring_clear(struct ring_data *data){
+  if(data->data)
+    memset(data->data, 0, data->size*sizeof(float));
+  data->index = 0;
+}
+
+int ring_resize(size_t size, struct ring_data *data){
+  if(size == data->size) return 1;
+  return make_ring_data(size, data);
+}
+
+// The length of the span starting at the index, and moves the index
+// past it.
+static inline size_t ring_span(size_t samples, size_t *index, struct ring_data *data){
+  size_t span = smin(samples, data->size - data->index);
+  *index = data->index;
+  data->index += span;
+  if(data->index == data->size) data->index = 0;
+  return span;
+}
+
+void ring_read(float *out, size_t samples, struct ring_data *data){
+  if(data->size == 0){
+    memset(out, 0, samples*sizeof(float));
+    return;
+  }
+  while(0 < samples){
+    size_t index, span = ring_span(samples, &index, data);
+    memcpy(out, data->data+index, span*sizeof(float));
+    out += span;
+    samples -= span;
+  }
+}
+
+void ring_write(float *in, size_t samples, struct ring_data *data){
+  if(data->size == 0) return;
+  while(0 < samples){
+    size_t index, span = ring_span(samples, &index, data);
+    memcpy(data->data+index, in, span*sizeof(float));
+    in += span;
+    samples -= span;
+  }
+}
+
+void ring_exchange(float *in, float *out, size_t samples, struct ring_data *data){
+  if(data->size == 0){
+    if(in != out)
+      memcpy(out, in, samples*sizeof(float));
+    return;
+  }
+  while(0 < samples){
+    size_t index, span = ring_span(samples, &index, data);
+    float *ring = data->data+index;
+    if(in == out){
+      // Swap through a small buffer, which is still only memcpy.
+      float swap[RING_SWAP];
+      for(size_t i=0; i<span; i+=RING_SWAP){
+        size_t chunk = smin(span-i, RING_SWAP);
+        memcpy(swap, ring+i, chunk*sizeof(float));
+        memcpy(ring+i, out+i, chunk*sizeof(float));
+        memcpy(out+i, swap, chunk*sizeof(float));
+      }
+    }else{
+      memcpy(out, ring, span*sizeof(float));
+      memcpy(ring, in, span*sizeof(float));
+    }
+    in += span;
+    out += span;
+    samples -= span;
+  }
+}
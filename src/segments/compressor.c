@@ -0,0 +1,456 @@
+#include "internal.h"
+
+// A feed-forward compressor with lookahead.
+//
+// The detector looks at the peak of all channels over the lookahead
+// window in front of each sample, found with a sliding window maximum
+// over a monotonic deque. The gain curve turns the peak into a target
+// gain, whose minimum over the window is then smoothed with a moving
+// average over the same window. As every target within the window is at
+// most the one needed for the peak, so is their average, and the delayed
+// audio never exceeds the threshold when limiting. Releases are slowed
+// further by a one-pole filter.
+//
+// Each block is processed in passes, so that the curve and the gain
+// application run as plain loops over samples that vectorize.
+
+#define COMPRESSOR_CHUNK 256
+
+struct compressor_segment_data{
+  struct mixed_buffer **in;
+  struct mixed_buffer **out;
+  size_t channels;
+  // Delay lines of all channels, window+1 samples each.
+  float *delay;
+  // Sliding window maximum, as a ring of indices and peaks.
+  size_t *deque_index;
+  float *deque_peak;
+  size_t deque_head;
+  size_t deque_count;
+  // Moving average of the target gains.
+  float *targets;
+  double target_sum;
+  size_t window;
+  size_t position;
+  size_t index;
+  float gain;
+  float peak[COMPRESSOR_CHUNK];
+  float curve[COMPRESSOR_CHUNK];
+  float delayed[COMPRESSOR_CHUNK];
+  float threshold;
+  float ratio;
+  float pregain;
+  float release;
+  float lookahead;
+  size_t samplerate;
+  bool fast_math;
+};
+
+static void clear_compressor_state(struct compressor_segment_data *data){
+  size_t size = data->window+1;
+  memset(data->delay, 0, data->channels*size*sizeof(float));
+  for(size_t i=0; i<size; ++i){
+    data->targets[i] = 1.0;
+  }
+  data->target_sum = size;
+  data->deque_head = 0;
+  data->deque_count = 0;
+  data->position = 0;
+  data->index = 0;
+  data->gain = 1.0;
+}
+
+// (Re)allocate the delay and detector for the current lookahead.
+// If this fails, the previous state is kept.
+static int resize_compressor_window(float lookahead, size_t samplerate, struct compressor_segment_data *data){
+  size_t window = lookahead*samplerate;
+  size_t size = window+1;
+  float *delay = calloc(data->channels*size + 2*size, sizeof(float));
+  size_t *deque_index = calloc(size, sizeof(size_t));
+  if(!delay || !deque_index){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    if(delay) free(delay);
+    if(deque_index) free(deque_index);
+    return 0;
+  }
+  if(data->delay)
+    free(data->delay);
+  if(data->deque_index)
+    free(data->deque_index);
+
+  data->delay = delay;
+  data->deque_peak = delay + data->channels*size;
+  data->targets = data->deque_peak + size;
+  data->deque_index = deque_index;
+  data->window = window;
+  data->lookahead = lookahead;
+  data->samplerate = samplerate;
+  clear_compressor_state(data);
+  return 1;
+}
+
+int compressor_segment_free(struct mixed_segment *segment){
+  struct compressor_segment_data *data = (struct compressor_segment_data *)segment->data;
+  if(data){
+    if(data->delay)
+      free(data->delay);
+    if(data->deque_index)
+      free(data->deque_index);
+    if(data->in)
+      free(data->in);
+    if(data->out)
+      free(data->out);
+    free(data);
+  }
+  segment->data = 0;
+  return 1;
+}
+
+int compressor_segment_start(struct mixed_segment *segment){
+  struct compressor_segment_data *data = (struct compressor_segment_data *)segment->data;
+  clear_compressor_state(data);
+  return 1;
+}
+
+int compressor_segment_set_in(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
+  struct compressor_segment_data *data = (struct compressor_segment_data *)segment->data;
+
+  switch(field){
+  case MIXED_BUFFER:
+    if(data->channels <= location){
+      mixed_err(MIXED_INVALID_LOCATION);
+      return 0;
+    }
+    data->in[location] = (struct mixed_buffer *)buffer;
+    return 1;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+}
+
+int compressor_segment_set_out(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
+  struct compressor_segment_data *data = (struct compressor_segment_data *)segment->data;
+
+  switch(field){
+  case MIXED_BUFFER:
+    if(data->channels <= location){
+      mixed_err(MIXED_INVALID_LOCATION);
+      return 0;
+    }
+    data->out[location] = (struct mixed_buffer *)buffer;
+    return 1;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+}
+
+// Pushes the peak of the newest sample and returns the maximum over
+// the last window+1 samples.
+static inline float push_peak(float peak, struct compressor_segment_data *data){
+  size_t size = data->window+1;
+  size_t *indices = data->deque_index;
+  float *peaks = data->deque_peak;
+  size_t head = data->deque_head;
+  size_t count = data->deque_count;
+  size_t index = data->index;
+
+  // Drop the oldest once it leaves the window. This comes first, so
+  // that the ring always has room for the newest.
+  while(count && indices[head] + size <= index){
+    head = (head+1)%size;
+    --count;
+  }
+  // Smaller peaks before a larger one can never be the maximum again.
+  while(count && peaks[(head+count-1)%size] <= peak){
+    --count;
+  }
+  indices[(head+count)%size] = index;
+  peaks[(head+count)%size] = peak;
+  ++count;
+
+  data->deque_head = head;
+  data->deque_count = count;
+  data->index = index+1;
+  return peaks[head];
+}
+
+int compressor_segment_mix(size_t samples, struct mixed_segment *segment){
+  struct compressor_segment_data *data = (struct compressor_segment_data *)segment->data;
+  size_t channels = data->channels;
+  size_t size = data->window+1;
+  float threshold = data->threshold;
+  float exponent = (isinf(data->ratio))? -1.0 : 1.0/data->ratio - 1.0;
+  float pregain = data->pregain;
+  float release = data->release;
+  float *peak = data->peak;
+  float *curve = data->curve;
+  float *delayed = data->delayed;
+
+  for(size_t i=0; i<samples; ){
+    size_t chunk = smin(samples-i, COMPRESSOR_CHUNK);
+    size_t position = data->position;
+
+    // Detect the peak over all channels.
+    for(size_t t=0; t<chunk; ++t){
+      peak[t] = 0.0;
+    }
+    for(size_t c=0; c<channels; ++c){
+      float *in = data->in[c]->data+i;
+      for(size_t t=0; t<chunk; ++t){
+        peak[t] = fmaxf(peak[t], fabsf(in[t]));
+      }
+    }
+    for(size_t t=0; t<chunk; ++t){
+      peak[t] = push_peak(pregain*peak[t], data);
+    }
+
+    // Evaluate the gain curve for the whole chunk. Unlike fmaxf, the
+    // comparisons do not keep these loops from being vectorized.
+    if(exponent == -1.0){
+      for(size_t t=0; t<chunk; ++t){
+        curve[t] = threshold / ((peak[t] < threshold)? threshold : peak[t]);
+      }
+    }else if(data->fast_math){
+      for(size_t t=0; t<chunk; ++t){
+        curve[t] = fast_pow(((peak[t] < threshold)? threshold : peak[t]) / threshold, exponent);
+      }
+    }else{
+      for(size_t t=0; t<chunk; ++t){
+        curve[t] = powf(fmaxf(peak[t], threshold) / threshold, exponent);
+      }
+    }
+
+    // Smooth the gain, replacing the curve with the final gain.
+    float *targets = data->targets;
+    double sum = data->target_sum;
+    float gain = data->gain;
+    for(size_t t=0; t<chunk; ++t){
+      size_t p = (position+t)%size;
+      sum += curve[t] - targets[p];
+      targets[p] = curve[t];
+      float average = sum / size;
+      gain = (average < gain)? average : gain + release*(average - gain);
+      curve[t] = gain*pregain;
+    }
+    data->target_sum = sum;
+    data->gain = gain;
+
+    // Delay every channel by the window and apply the gain.
+    for(size_t c=0; c<channels; ++c){
+      float *in = data->in[c]->data+i;
+      float *out = data->out[c]->data+i;
+      float *delay = data->delay+c*size;
+      for(size_t t=0; t<chunk; ++t){
+        size_t p = (position+t)%size;
+        delay[p] = in[t];
+        delayed[t] = delay[(p+1 == size)? 0 : p+1];
+      }
+      for(size_t t=0; t<chunk; ++t){
+        out[t] = curve[t]*delayed[t];
+      }
+    }
+
+    data->position = (position+chunk)%size;
+    i += chunk;
+  }
+  return 1;
+}
+
+int compressor_segment_mix_bypass(size_t samples, struct mixed_segment *segment){
+  struct compressor_segment_data *data = (struct compressor_segment_data *)segment->data;
+
+  for(size_t c=0; c<data->channels; ++c){
+    mixed_buffer_copy(data->in[c], data->out[c]);
+  }
+  return 1;
+}
+
+int compressor_segment_info(struct mixed_segment_info *info, struct mixed_segment *segment){
+  struct compressor_segment_data *data = (struct compressor_segment_data *)segment->data;
+  info->name = "compressor";
+  info->description = "Compress or limit the dynamic range of the input.";
+  info->flags = MIXED_INPLACE;
+  info->min_inputs = data->channels;
+  info->max_inputs = data->channels;
+  info->outputs = data->channels;
+
+  struct mixed_segment_field_info *field = info->fields;
+  set_info_field(field++, MIXED_BUFFER,
+                 MIXED_BUFFER_POINTER, 1, MIXED_IN | MIXED_OUT | MIXED_SET,
+                 "The buffer for audio data attached to the location.");
+
+  set_info_field(field++, MIXED_COMPRESSOR_THRESHOLD,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The level in dB above which the signal is compressed.");
+
+  set_info_field(field++, MIXED_COMPRESSOR_RATIO,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The ratio by which the level above the threshold is reduced.");
+
+  set_info_field(field++, MIXED_COMPRESSOR_PREGAIN,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The gain in dB applied to the input before compression.");
+
+  set_info_field(field++, MIXED_COMPRESSOR_LOOKAHEAD,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The time in seconds the gain reacts ahead of the signal.");
+
+  set_info_field(field++, MIXED_COMPRESSOR_RELEASE,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The time in seconds the gain takes to recover.");
+
+  set_info_field(field++, MIXED_COMPRESSOR_REDUCTION,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_GET,
+                 "The current gain reduction in dB.");
+
+  set_info_field(field++, MIXED_FAST_MATH,
+                 MIXED_BOOL, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "Whether to approximate the gain curve for finite ratios.");
+
+  set_info_field(field++, MIXED_LATENCY,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_GET,
+                 "The delay of the output in samples.");
+
+  set_info_field(field++, MIXED_SAMPLERATE,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The samplerate at which the segment operates.");
+
+  set_info_field(field++, MIXED_BYPASS,
+                 MIXED_BOOL, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "Bypass the segment's processing.");
+
+  clear_info_field(field++);
+  return 1;
+}
+
+static float release_time(float coefficient, size_t samplerate){
+  return (coefficient < 1.0)? -1.0/(log(1.0-coefficient)*samplerate) : 0.0;
+}
+
+static float release_coefficient(float time, size_t samplerate){
+  return (0.0 < time)? 1.0-exp(-1.0/(time*samplerate)) : 1.0;
+}
+
+int compressor_segment_get(size_t field, void *value, struct mixed_segment *segment){
+  struct compressor_segment_data *data = (struct compressor_segment_data *)segment->data;
+  switch(field){
+  case MIXED_COMPRESSOR_THRESHOLD: *((float *)value) = linear_to_db(data->threshold); break;
+  case MIXED_COMPRESSOR_RATIO: *((float *)value) = data->ratio; break;
+  case MIXED_COMPRESSOR_PREGAIN: *((float *)value) = linear_to_db(data->pregain); break;
+  case MIXED_COMPRESSOR_LOOKAHEAD: *((float *)value) = data->lookahead; break;
+  case MIXED_COMPRESSOR_RELEASE: *((float *)value) = release_time(data->release, data->samplerate); break;
+  case MIXED_COMPRESSOR_REDUCTION: *((float *)value) = -linear_to_db(data->gain); break;
+  case MIXED_FAST_MATH: *((bool *)value) = data->fast_math; break;
+  case MIXED_LATENCY: *((size_t *)value) = data->window; break;
+  case MIXED_SAMPLERATE: *((size_t *)value) = data->samplerate; break;
+  case MIXED_BYPASS: *((bool *)value) = (segment->mix == compressor_segment_mix_bypass); break;
+  default: mixed_err(MIXED_INVALID_FIELD); return 0;
+  }
+  return 1;
+}
+
+int compressor_segment_set(size_t field, void *value, struct mixed_segment *segment){
+  struct compressor_segment_data *data = (struct compressor_segment_data *)segment->data;
+  switch(field){
+  case MIXED_COMPRESSOR_THRESHOLD:
+    if(0.0 < *(float *)value){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->threshold = db_to_linear(*(float *)value);
+    break;
+  case MIXED_COMPRESSOR_RATIO:
+    if(*(float *)value < 1.0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->ratio = *(float *)value;
+    break;
+  case MIXED_COMPRESSOR_PREGAIN:
+    data->pregain = db_to_linear(*(float *)value);
+    break;
+  case MIXED_COMPRESSOR_LOOKAHEAD:
+    if(*(float *)value < 0.0 || 1.0 < *(float *)value){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    return resize_compressor_window(*(float *)value, data->samplerate, data);
+  case MIXED_COMPRESSOR_RELEASE:
+    if(*(float *)value < 0.0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->release = release_coefficient(*(float *)value, data->samplerate);
+    break;
+  case MIXED_FAST_MATH:
+    data->fast_math = *(bool *)value;
+    break;
+  case MIXED_SAMPLERATE:{
+    if(*(size_t *)value <= 0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    float release = release_time(data->release, data->samplerate);
+    if(!resize_compressor_window(data->lookahead, *(size_t *)value, data)){
+      return 0;
+    }
+    data->release = release_coefficient(release, data->samplerate);
+    break;}
+  case MIXED_BYPASS:
+    if(*(bool *)value){
+      segment->mix = compressor_segment_mix_bypass;
+    }else{
+      segment->mix = compressor_segment_mix;
+    }
+    break;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+  return 1;
+}
+
+MIXED_EXPORT int mixed_make_segment_compressor(size_t channels, size_t samplerate, struct mixed_segment *segment){
+  struct compressor_segment_data *data = calloc(1, sizeof(struct compressor_segment_data));
+  if(!data){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    return 0;
+  }
+
+  data->channels = channels;
+  data->in = calloc(channels, sizeof(struct mixed_buffer *));
+  data->out = calloc(channels, sizeof(struct mixed_buffer *));
+  if(!data->in || !data->out){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    goto cleanup;
+  }
+
+  if(!resize_compressor_window(0.005, samplerate, data)){
+    goto cleanup;
+  }
+
+  data->threshold = db_to_linear(-1.0);
+  data->ratio = INFINITY;
+  data->fast_math = 1;
+  data->pregain = 1.0;
+  data->release = release_coefficient(0.1, samplerate);
+
+  segment->free = compressor_segment_free;
+  segment->start = compressor_segment_start;
+  segment->mix = compressor_segment_mix;
+  segment->set_in = compressor_segment_set_in;
+  segment->set_out = compressor_segment_set_out;
+  segment->info = compressor_segment_info;
+  segment->get = compressor_segment_get;
+  segment->set = compressor_segment_set;
+  segment->data = data;
+  return 1;
+
+ cleanup:
+  if(data->in) free(data->in);
+  if(data->out) free(data->out);
+  free(data);
+  return 0;
+}
@@ -0,0 +1,431 @@
+#include "internal.h"
+
+// Uniformly partitioned overlap-save convolution.
+//
+// The impulse response is cut into partitions of the partition size, each
+// of which is transformed once with zero padding to twice that size. Every
+// time a partition's worth of input has been collected, the last two input
+// partitions are transformed and stored in a ring of past input spectra.
+// The output spectrum is then the sum of every past input spectrum times
+// the impulse response partition of the same age, and the second half of
+// its inverse transform is the next partition of output. The output thus
+// lags behind by exactly one partition, regardless of the impulse length.
+
+// The spectra of an impulse response, shared between all segments
+// using the same response with the same partition size. Real and
+// imaginary parts are kept apart so that the multiply-add vectorizes.
+struct convolution_ir{
+  float *ir;
+  size_t length;
+  size_t partition;
+  size_t partitions;
+  uint32_t hash;
+  float *real;
+  float *imag;
+  size_t references;
+  struct convolution_ir *next;
+};
+
+struct convolution_segment_data{
+  struct mixed_buffer *in;
+  struct mixed_buffer *out;
+  struct convolution_ir *ir;
+  struct fft_tables *tables;
+  float *input;
+  float *output;
+  float *spectrum;
+  float *history_real;
+  float *history_imag;
+  float *sum_real;
+  float *sum_imag;
+  size_t partition;
+  size_t head;
+  size_t fill;
+};
+
+static struct convolution_ir *ir_cache = 0;
+static volatile int ir_lock = 0;
+
+static void lock_ir_cache(){
+  while(__sync_lock_test_and_set(&ir_lock, 1));
+}
+
+static void unlock_ir_cache(){
+  __sync_lock_release(&ir_lock);
+}
+
+static uint32_t hash_ir(float *ir, size_t length){
+  unsigned char *bytes = (unsigned char *)ir;
+  uint32_t hash = 2166136261u;
+  for(size_t i=0; i<length*sizeof(float); ++i){
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static void free_convolution_ir(struct convolution_ir *ir){
+  if(ir->ir)
+    free(ir->ir);
+  if(ir->real)
+    free(ir->real);
+  free(ir);
+}
+
+static struct convolution_ir *make_convolution_ir(float *samples, size_t length, size_t partition, uint32_t hash, struct fft_plan *plan){
+  size_t bins = partition+1;
+  size_t partitions = (length+partition-1)/partition;
+  struct convolution_ir *ir = calloc(1, sizeof(struct convolution_ir));
+  if(!ir){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    return 0;
+  }
+  ir->ir = calloc(length, sizeof(float));
+  ir->real = calloc(partitions*bins*2, sizeof(float));
+  float *spectrum = calloc(2*partition+2, sizeof(float));
+  if(!ir->ir || !ir->real || !spectrum){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    if(spectrum) free(spectrum);
+    free_convolution_ir(ir);
+    return 0;
+  }
+  memcpy(ir->ir, samples, length*sizeof(float));
+  ir->imag = ir->real + partitions*bins;
+  ir->length = length;
+  ir->partition = partition;
+  ir->partitions = partitions;
+  ir->hash = hash;
+  ir->references = 1;
+
+  // The scale of the inverse transform is folded into the spectra.
+  float scale = 1.0/(2*partition);
+  for(size_t p=0; p<partitions; ++p){
+    size_t count = smin(partition, length-p*partition);
+    memset(spectrum, 0, (2*partition+2)*sizeof(float));
+    for(size_t i=0; i<count; ++i){
+      spectrum[i] = samples[p*partition+i] * scale;
+    }
+    fft_forward(spectrum, spectrum, plan);
+    for(size_t k=0; k<bins; ++k){
+      ir->real[p*bins+k] = spectrum[2*k];
+      ir->imag[p*bins+k] = spectrum[2*k+1];
+    }
+  }
+  free(spectrum);
+  return ir;
+}
+
+// Impulse responses are matched by their contents, so that responses
+// loaded separately are still only stored once.
+static struct convolution_ir *acquire_convolution_ir(float *samples, size_t length, size_t partition, struct fft_plan *plan){
+  uint32_t hash = hash_ir(samples, length);
+  struct convolution_ir *ir;
+  lock_ir_cache();
+  for(ir=ir_cache; ir; ir=ir->next){
+    if(ir->hash == hash && ir->length == length && ir->partition == partition
+       && memcmp(ir->ir, samples, length*sizeof(float)) == 0){
+      ++ir->references;
+      break;
+    }
+  }
+  if(!ir){
+    ir = make_convolution_ir(samples, length, partition, hash, plan);
+    if(ir){
+      ir->next = ir_cache;
+      ir_cache = ir;
+    }
+  }
+  unlock_ir_cache();
+  return ir;
+}
+
+static void release_convolution_ir(struct convolution_ir *ir){
+  if(!ir) return;
+  lock_ir_cache();
+  if(--ir->references == 0){
+    struct convolution_ir **prev = &ir_cache;
+    while(*prev != ir) prev = &(*prev)->next;
+    *prev = ir->next;
+    free_convolution_ir(ir);
+  }
+  unlock_ir_cache();
+}
+
+static void free_convolution_state(struct convolution_segment_data *data){
+  release_fft_tables(data->tables);
+  data->tables = 0;
+  // All per-instance arrays are carved out of one allocation.
+  if(data->input)
+    free(data->input);
+  data->input = 0;
+  data->output = 0;
+  data->spectrum = 0;
+  data->history_real = 0;
+  data->history_imag = 0;
+  data->sum_real = 0;
+  data->sum_imag = 0;
+}
+
+// Sets up the state for the given partition size with the impulse
+// response. On failure, the previous state is kept.
+static int make_convolution_state(float *samples, size_t length, size_t partition, struct convolution_segment_data *data){
+  if(partition < 2 || (partition & (partition-1)) || length == 0){
+    mixed_err(MIXED_INVALID_VALUE);
+    return 0;
+  }
+
+  size_t bins = partition+1;
+  size_t partitions = (length+partition-1)/partition;
+  struct fft_tables *tables = acquire_fft_tables(2*partition, 1);
+  if(!tables){
+    return 0;
+  }
+  struct convolution_ir *ir = acquire_convolution_ir(samples, length, partition, &tables->plan);
+  if(!ir){
+    release_fft_tables(tables);
+    return 0;
+  }
+  float *memory = calloc(2*partition + partition + 2*partition+2 + 2*partitions*bins + 2*bins, sizeof(float));
+  if(!memory){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    release_convolution_ir(ir);
+    release_fft_tables(tables);
+    return 0;
+  }
+
+  free_convolution_state(data);
+  release_convolution_ir(data->ir);
+
+  data->input = memory; memory += 2*partition;
+  data->output = memory; memory += partition;
+  data->spectrum = memory; memory += 2*partition+2;
+  data->history_real = memory; memory += partitions*bins;
+  data->history_imag = memory; memory += partitions*bins;
+  data->sum_real = memory; memory += bins;
+  data->sum_imag = memory; memory += bins;
+
+  data->tables = tables;
+  data->ir = ir;
+  data->partition = partition;
+  data->head = 0;
+  data->fill = 0;
+  return 1;
+}
+
+static void complex_multiply_add(float *restrict sum_real, float *restrict sum_imag,
+                                 const float *restrict a_real, const float *restrict a_imag,
+                                 const float *restrict b_real, const float *restrict b_imag,
+                                 size_t count){
+  for(size_t k=0; k<count; ++k){
+    sum_real[k] += a_real[k]*b_real[k] - a_imag[k]*b_imag[k];
+    sum_imag[k] += a_real[k]*b_imag[k] + a_imag[k]*b_real[k];
+  }
+}
+
+static void convolve_partition(struct convolution_segment_data *data){
+  size_t partition = data->partition;
+  size_t partitions = data->ir->partitions;
+  size_t bins = partition+1;
+  float *spectrum = data->spectrum;
+  struct fft_plan *plan = &data->tables->plan;
+
+  fft_forward(data->input, spectrum, plan);
+  float *history_real = data->history_real + data->head*bins;
+  float *history_imag = data->history_imag + data->head*bins;
+  for(size_t k=0; k<bins; ++k){
+    history_real[k] = spectrum[2*k];
+    history_imag[k] = spectrum[2*k+1];
+  }
+
+  memset(data->sum_real, 0, bins*sizeof(float));
+  memset(data->sum_imag, 0, bins*sizeof(float));
+  size_t slot = data->head;
+  for(size_t p=0; p<partitions; ++p){
+    complex_multiply_add(data->sum_real, data->sum_imag,
+                         data->history_real + slot*bins, data->history_imag + slot*bins,
+                         data->ir->real + p*bins, data->ir->imag + p*bins,
+                         bins);
+    slot = (slot == 0)? partitions-1 : slot-1;
+  }
+
+  for(size_t k=0; k<bins; ++k){
+    spectrum[2*k] = data->sum_real[k];
+    spectrum[2*k+1] = data->sum_imag[k];
+  }
+  fft_inverse(spectrum, spectrum, plan);
+  // The first half is wrapped around by the circular convolution.
+  memcpy(data->output, spectrum+partition, partition*sizeof(float));
+
+  memmove(data->input, data->input+partition, partition*sizeof(float));
+  data->head = (data->head+1 == partitions)? 0 : data->head+1;
+}
+
+int convolution_segment_free(struct mixed_segment *segment){
+  struct convolution_segment_data *data = (struct convolution_segment_data *)segment->data;
+  if(data){
+    free_convolution_state(data);
+    release_convolution_ir(data->ir);
+    free(data);
+  }
+  segment->data = 0;
+  return 1;
+}
+
+int convolution_segment_start(struct mixed_segment *segment){
+  struct convolution_segment_data *data = (struct convolution_segment_data *)segment->data;
+  size_t partition = data->partition;
+  size_t partitions = data->ir->partitions;
+  memset(data->input, 0, 2*partition*sizeof(float));
+  memset(data->output, 0, partition*sizeof(float));
+  memset(data->history_real, 0, partitions*(partition+1)*sizeof(float));
+  memset(data->history_imag, 0, partitions*(partition+1)*sizeof(float));
+  data->head = 0;
+  data->fill = 0;
+  return 1;
+}
+
+int convolution_segment_set_in(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
+  struct convolution_segment_data *data = (struct convolution_segment_data *)segment->data;
+
+  switch(field){
+  case MIXED_BUFFER:
+    if(location == 0){
+      data->in = (struct mixed_buffer *)buffer;
+      return 1;
+    }
+    mixed_err(MIXED_INVALID_LOCATION);
+    return 0;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+}
+
+int convolution_segment_set_out(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
+  struct convolution_segment_data *data = (struct convolution_segment_data *)segment->data;
+
+  switch(field){
+  case MIXED_BUFFER:
+    if(location == 0){
+      data->out = (struct mixed_buffer *)buffer;
+      return 1;
+    }
+    mixed_err(MIXED_INVALID_LOCATION);
+    return 0;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+}
+
+int convolution_segment_mix(size_t samples, struct mixed_segment *segment){
+  struct convolution_segment_data *data = (struct convolution_segment_data *)segment->data;
+  size_t partition = data->partition;
+  float *in = data->in->data;
+  float *out = data->out->data;
+
+  size_t i = 0;
+  while(i < samples){
+    size_t chunk = smin(samples-i, partition-data->fill);
+    // The input is taken first, as the output may be the same buffer.
+    memcpy(data->input+partition+data->fill, in+i, chunk*sizeof(float));
+    memcpy(out+i, data->output+data->fill, chunk*sizeof(float));
+    data->fill += chunk;
+    i += chunk;
+
+    if(data->fill == partition){
+      convolve_partition(data);
+      data->fill = 0;
+    }
+  }
+  return 1;
+}
+
+int convolution_segment_mix_bypass(size_t samples, struct mixed_segment *segment){
+  struct convolution_segment_data *data = (struct convolution_segment_data *)segment->data;
+
+  return mixed_buffer_copy(data->in, data->out);
+}
+
+int convolution_segment_info(struct mixed_segment_info *info, struct mixed_segment *segment){
+  struct convolution_segment_data *data = (struct convolution_segment_data *)segment->data;
+  info->name = "convolution";
+  info->description = "Convolve the input with an impulse response.";
+  info->flags = MIXED_INPLACE;
+  info->min_inputs = 1;
+  info->max_inputs = 1;
+  info->outputs = 1;
+
+  struct mixed_segment_field_info *field = info->fields;
+  set_info_field(field++, MIXED_BUFFER,
+                 MIXED_BUFFER_POINTER, 1, MIXED_IN | MIXED_OUT | MIXED_SET,
+                 "The buffer for audio data attached to the location.");
+
+  set_info_field(field++, MIXED_CONVOLUTION_PARTITION,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The number of samples the impulse response is processed in.");
+
+  set_info_field(field++, MIXED_LATENCY,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_GET,
+                 "The delay of the output in samples.");
+
+  set_info_field(field++, MIXED_BYPASS,
+                 MIXED_BOOL, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "Bypass the segment's processing.");
+
+  clear_info_field(field++);
+  return 1;
+}
+
+int convolution_segment_get(size_t field, void *value, struct mixed_segment *segment){
+  struct convolution_segment_data *data = (struct convolution_segment_data *)segment->data;
+  switch(field){
+  case MIXED_CONVOLUTION_PARTITION: *((size_t *)value) = data->partition; break;
+  case MIXED_LATENCY: *((size_t *)value) = data->partition; break;
+  case MIXED_BYPASS: *((bool *)value) = (segment->mix == convolution_segment_mix_bypass); break;
+  default: mixed_err(MIXED_INVALID_FIELD); return 0;
+  }
+  return 1;
+}
+
+int convolution_segment_set(size_t field, void *value, struct mixed_segment *segment){
+  struct convolution_segment_data *data = (struct convolution_segment_data *)segment->data;
+  switch(field){
+  case MIXED_CONVOLUTION_PARTITION:
+    return make_convolution_state(data->ir->ir, data->ir->length, *(size_t *)value, data);
+  case MIXED_BYPASS:
+    if(*(bool *)value){
+      segment->mix = convolution_segment_mix_bypass;
+    }else{
+      segment->mix = convolution_segment_mix;
+    }
+    break;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+  return 1;
+}
+
+MIXED_EXPORT int mixed_make_segment_convolution(float *ir, size_t length, size_t partition, struct mixed_segment *segment){
+  struct convolution_segment_data *data = calloc(1, sizeof(struct convolution_segment_data));
+  if(!data){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    return 0;
+  }
+
+  if(!make_convolution_state(ir, length, partition, data)){
+    free(data);
+    return 0;
+  }
+
+  segment->free = convolution_segment_free;
+  segment->start = convolution_segment_start;
+  segment->mix = convolution_segment_mix;
+  segment->set_in = convolution_segment_set_in;
+  segment->set_out = convolution_segment_set_out;
+  segment->info = convolution_segment_info;
+  segment->get = convolution_segment_get;
+  segment->set = convolution_segment_set;
+  segment->data = data;
+  return 1;
+}
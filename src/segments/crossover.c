@@ -0,0 +1,286 @@
+#include "internal.h"
+
+// Splits the input into bands with fourth-order Linkwitz-Riley filters.
+//
+// The crossovers are applied from the lowest frequency upwards: each one
+// takes the low pass of what is left as its band, and hands the high
+// pass on to the next crossover, so every band after the first reuses
+// the filtering already done for the bands below it. The low and high
+// pass of a Linkwitz-Riley crossover sum to an allpass, so to keep the
+// bands in phase with each other, every band also passes through the
+// allpasses of the crossovers above it. The bands then sum up to an
+// allpassed copy of the input.
+
+#define CROSSOVER_MIN_BANDS 2
+#define CROSSOVER_MAX_BANDS 5
+#define CROSSOVER_CHUNK 64
+
+struct crossover_section{
+  struct biquad_coefficients c;
+  float x1, x2, y1, y2;
+};
+
+struct crossover_segment_data{
+  struct mixed_buffer *in;
+  struct mixed_buffer *out[CROSSOVER_MAX_BANDS];
+  // Two Butterworth sections each make up the fourth order filters.
+  struct crossover_section low[CROSSOVER_MAX_BANDS-1][2];
+  struct crossover_section high[CROSSOVER_MAX_BANDS-1][2];
+  // The allpass of crossover j applied to band i.
+  struct crossover_section allpass[CROSSOVER_MAX_BANDS-1][CROSSOVER_MAX_BANDS-1];
+  float frequencies[CROSSOVER_MAX_BANDS-1];
+  size_t bands;
+  size_t samplerate;
+};
+
+static inline float crossover_tick(struct crossover_section *s, float x){
+  float y = s->c.b0*x + s->c.b1*s->x1 + s->c.b2*s->x2 - s->c.a2*s->y2 - s->c.a1*s->y1;
+  s->x2 = s->x1; s->x1 = x;
+  s->y2 = s->y1; s->y1 = y;
+  return y;
+}
+
+// Silence decays into denormals, which are very slow to compute with.
+static inline struct crossover_section crossover_flush(struct crossover_section s){
+  if(fabsf(s.y1) < 1e-30f) s.y1 = 0.0;
+  if(fabsf(s.y2) < 1e-30f) s.y2 = 0.0;
+  return s;
+}
+
+static void compute_crossovers(struct crossover_segment_data *data){
+  for(size_t j=0; j+1<data->bands; ++j){
+    float frequency = data->frequencies[j];
+    struct biquad_coefficients low, high, allpass;
+    biquad_lowpass(frequency, M_SQRT1_2, data->samplerate, &low);
+    biquad_highpass(frequency, M_SQRT1_2, data->samplerate, &high);
+    biquad_allpass(frequency, M_SQRT1_2, data->samplerate, &allpass);
+    data->low[j][0].c = data->low[j][1].c = low;
+    data->high[j][0].c = data->high[j][1].c = high;
+    for(size_t i=0; i<j; ++i){
+      data->allpass[i][j].c = allpass;
+    }
+  }
+}
+
+int crossover_segment_free(struct mixed_segment *segment){
+  if(segment->data){
+    free(segment->data);
+  }
+  segment->data = 0;
+  return 1;
+}
+
+int crossover_segment_start(struct mixed_segment *segment){
+  struct crossover_segment_data *data = (struct crossover_segment_data *)segment->data;
+  for(size_t j=0; j<CROSSOVER_MAX_BANDS-1; ++j){
+    for(size_t k=0; k<2; ++k){
+      struct crossover_section *low = &data->low[j][k], *high = &data->high[j][k];
+      low->x1 = low->x2 = low->y1 = low->y2 = 0.0;
+      high->x1 = high->x2 = high->y1 = high->y2 = 0.0;
+    }
+    for(size_t i=0; i<CROSSOVER_MAX_BANDS-1; ++i){
+      struct crossover_section *allpass = &data->allpass[i][j];
+      allpass->x1 = allpass->x2 = allpass->y1 = allpass->y2 = 0.0;
+    }
+  }
+  return 1;
+}
+
+int crossover_segment_set_in(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
+  struct crossover_segment_data *data = (struct crossover_segment_data *)segment->data;
+
+  switch(field){
+  case MIXED_BUFFER:
+    if(location == 0){
+      data->in = (struct mixed_buffer *)buffer;
+      return 1;
+    }
+    mixed_err(MIXED_INVALID_LOCATION);
+    return 0;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+}
+
+int crossover_segment_set_out(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
+  struct crossover_segment_data *data = (struct crossover_segment_data *)segment->data;
+
+  switch(field){
+  case MIXED_BUFFER:
+    if(location < data->bands){
+      data->out[location] = (struct mixed_buffer *)buffer;
+      return 1;
+    }
+    mixed_err(MIXED_INVALID_LOCATION);
+    return 0;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+}
+
+int crossover_segment_mix(size_t samples, struct mixed_segment *segment){
+  struct crossover_segment_data *data = (struct crossover_segment_data *)segment->data;
+  size_t last = data->bands-1;
+  // The input is copied first, so that it may share a buffer with a band.
+  float rest[CROSSOVER_CHUNK];
+
+  for(size_t i=0; i<samples; i+=CROSSOVER_CHUNK){
+    size_t chunk = smin(samples-i, CROSSOVER_CHUNK);
+    memcpy(rest, data->in->data+i, chunk*sizeof(float));
+
+    for(size_t j=0; j<last; ++j){
+      // Local copies keep the filter state out of memory in the loop.
+      struct crossover_section l0 = data->low[j][0], l1 = data->low[j][1];
+      struct crossover_section h0 = data->high[j][0], h1 = data->high[j][1];
+      float *band = data->out[j]->data+i;
+      for(size_t t=0; t<chunk; ++t){
+        float x = rest[t];
+        band[t] = crossover_tick(&l1, crossover_tick(&l0, x));
+        rest[t] = crossover_tick(&h1, crossover_tick(&h0, x));
+      }
+      data->low[j][0] = crossover_flush(l0); data->low[j][1] = crossover_flush(l1);
+      data->high[j][0] = crossover_flush(h0); data->high[j][1] = crossover_flush(h1);
+
+      for(size_t k=j+1; k<last; ++k){
+        struct crossover_section a = data->allpass[j][k];
+        for(size_t t=0; t<chunk; ++t){
+          band[t] = crossover_tick(&a, band[t]);
+        }
+        data->allpass[j][k] = crossover_flush(a);
+      }
+    }
+    memcpy(data->out[last]->data+i, rest, chunk*sizeof(float));
+  }
+  return 1;
+}
+
+int crossover_segment_mix_bypass(size_t samples, struct mixed_segment *segment){
+  struct crossover_segment_data *data = (struct crossover_segment_data *)segment->data;
+
+  // Everything ends up in the lowest band.
+  mixed_buffer_copy(data->in, data->out[0]);
+  for(size_t j=1; j<data->bands; ++j){
+    memset(data->out[j]->data, 0, samples*sizeof(float));
+  }
+  return 1;
+}
+
+int crossover_segment_info(struct mixed_segment_info *info, struct mixed_segment *segment){
+  struct crossover_segment_data *data = (struct crossover_segment_data *)segment->data;
+
+  info->name = "crossover";
+  info->description = "Split the input into frequency bands.";
+  info->flags = MIXED_INPLACE;
+  info->min_inputs = 1;
+  info->max_inputs = 1;
+  info->outputs = data->bands;
+
+  struct mixed_segment_field_info *field = info->fields;
+  set_info_field(field++, MIXED_BUFFER,
+                 MIXED_BUFFER_POINTER, 1, MIXED_IN | MIXED_OUT | MIXED_SET,
+                 "The buffer for audio data attached to the location. Output N is band N, from low to high.");
+
+  set_info_field(field++, MIXED_CROSSOVER_FREQUENCIES,
+                 MIXED_FLOAT, data->bands-1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The ascending frequencies in Hz at which the bands are split.");
+
+  set_info_field(field++, MIXED_SAMPLERATE,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The samplerate at which the segment operates.");
+
+  set_info_field(field++, MIXED_BYPASS,
+                 MIXED_BOOL, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "Bypass the segment's processing.");
+
+  clear_info_field(field++);
+  return 1;
+}
+
+int crossover_segment_get(size_t field, void *value, struct mixed_segment *segment){
+  struct crossover_segment_data *data = (struct crossover_segment_data *)segment->data;
+  switch(field){
+  case MIXED_CROSSOVER_FREQUENCIES:
+    memcpy(value, data->frequencies, (data->bands-1)*sizeof(float));
+    break;
+  case MIXED_SAMPLERATE: *((size_t *)value) = data->samplerate; break;
+  case MIXED_BYPASS: *((bool *)value) = (segment->mix == crossover_segment_mix_bypass); break;
+  default: mixed_err(MIXED_INVALID_FIELD); return 0;
+  }
+  return 1;
+}
+
+int crossover_segment_set(size_t field, void *value, struct mixed_segment *segment){
+  struct crossover_segment_data *data = (struct crossover_segment_data *)segment->data;
+  switch(field){
+  case MIXED_CROSSOVER_FREQUENCIES: {
+    float *frequencies = (float *)value;
+    for(size_t j=0; j+1<data->bands; ++j){
+      if(frequencies[j] <= 0.0 || data->samplerate <= 2*frequencies[j]
+         || (0 < j && frequencies[j] <= frequencies[j-1])){
+        mixed_err(MIXED_INVALID_VALUE);
+        return 0;
+      }
+    }
+    memcpy(data->frequencies, frequencies, (data->bands-1)*sizeof(float));
+    compute_crossovers(data);
+  } break;
+  case MIXED_SAMPLERATE:
+    if(*(size_t *)value <= 2*data->frequencies[data->bands-2]){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->samplerate = *(size_t *)value;
+    compute_crossovers(data);
+    break;
+  case MIXED_BYPASS:
+    if(*(bool *)value){
+      segment->mix = crossover_segment_mix_bypass;
+    }else{
+      segment->mix = crossover_segment_mix;
+    }
+    break;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+  return 1;
+}
+
+MIXED_EXPORT int mixed_make_segment_crossover(size_t bands, size_t samplerate, struct mixed_segment *segment){
+  if(bands < CROSSOVER_MIN_BANDS || CROSSOVER_MAX_BANDS < bands){
+    mixed_err(MIXED_INVALID_VALUE);
+    return 0;
+  }
+
+  struct crossover_segment_data *data = calloc(1, sizeof(struct crossover_segment_data));
+  if(!data){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    return 0;
+  }
+
+  data->bands = bands;
+  data->samplerate = samplerate;
+  // Spread the crossovers evenly over 100Hz to 10kHz on a log scale.
+  for(size_t j=0; j+1<bands; ++j){
+    data->frequencies[j] = 100.0*pow(100.0, (float)(j+1)/bands);
+  }
+  if(samplerate <= 2*data->frequencies[bands-2]){
+    mixed_err(MIXED_INVALID_VALUE);
+    free(data);
+    return 0;
+  }
+  compute_crossovers(data);
+
+  segment->free = crossover_segment_free;
+  segment->start = crossover_segment_start;
+  segment->mix = crossover_segment_mix;
+  segment->set_in = crossover_segment_set_in;
+  segment->set_out = crossover_segment_set_out;
+  segment->info = crossover_segment_info;
+  segment->get = crossover_segment_get;
+  segment->set = crossover_segment_set;
+  segment->data = data;
+  return 1;
+}
@@ -3,15 +3,14 @@
 struct delay_segment_data{
   struct mixed_buffer *in;
   struct mixed_buffer *out;
-  struct mixed_buffer buffer;
-  size_t buffer_index;
+  struct ring_data ring;
   float time;
   size_t samplerate;
 };
 
 int delay_segment_free(struct mixed_segment *segment){
   if(segment->data){
-    mixed_free_buffer(&((struct delay_segment_data *)segment->data)->buffer);
+    free_ring_data(&((struct delay_segment_data *)segment->data)->ring);
     free(segment->data);
   }
   segment->data = 0;
@@ -22,8 +21,7 @@ int delay_segment_free(struct mixed_segment *segment){
 
 int delay_segment_start(struct mixed_segment *segment){
   struct delay_segment_data *data = (struct delay_segment_data *)segment->data;
-  data->buffer_index = 0.0;
-  mixed_buffer_clear(&data->buffer);
+  ring_clear(&data->ring);
   return 1;
 }
 
@@ -64,20 +62,9 @@ int delay_segment_set_out(size_t field, size_t location, void *buffer, struct mi
 int delay_segment_mix(size_t samples, struct mixed_segment *segment){
   struct delay_segment_data *data = (struct delay_segment_data *)segment->data;
 
-  size_t delay_samples = data->buffer.size;
-  size_t index = data->buffer_index;
-
-  float *buf = data->buffer.data;
-  float *in = data->in->data;
-  float *out = data->out->data;
-  for(size_t i=0; i<samples; ++i){
-    float in_sample = in[i];
-    out[i] = buf[index];
-    buf[index] = in_sample;
-    index = (index+1)%delay_samples;
-  }
-
-  data->buffer_index = index;
+  // The ring holds exactly the delayed samples, so the output is what
+  // the input replaces in it.
+  ring_exchange(data->in->data, data->out->data, samples, &data->ring);
   return 1;
 }
 
@@ -136,16 +123,20 @@ int delay_segment_set(size_t field, void *value, struct mixed_segment *segment){
       mixed_err(MIXED_INVALID_VALUE);
       return 0;
     }
+    if(!ring_resize(ceil(*(size_t *)value * data->time), &data->ring)){
+      return 0;
+    }
     data->samplerate = *(size_t *)value;
-    mixed_buffer_resize(ceil(data->samplerate * data->time), &data->buffer);
     break;
   case MIXED_DELAY_TIME:
     if(*(float *)value < 0.0){
       mixed_err(MIXED_INVALID_VALUE);
       return 0;
     }
+    if(!ring_resize(ceil(data->samplerate * *(float *)value), &data->ring)){
+      return 0;
+    }
     data->time = *(float *)value;
-    mixed_buffer_resize(ceil(data->samplerate * data->time), &data->buffer);
     break;
   case MIXED_BYPASS:
     if(*(bool *)value){
@@ -168,7 +159,7 @@ MIXED_EXPORT int mixed_make_segment_delay(float time, size_t samplerate, struct
     return 0;
   }
 
-  if(!mixed_make_buffer(ceil(time * samplerate), &data->buffer)){
+  if(!make_ring_data(ceil(time * samplerate), &data->ring)){
     free(data);
     return 0;
   }
@@ -0,0 +1,357 @@
+#include "internal.h"
+
+// The input is written into a ring that holds the longest delay, and
+// every output sample is interpolated from the ring at its own delay.
+// The ring's size is a power of two, so that the taps can be found by
+// masking instead of wrapping around its end.
+//
+// The samples are processed in chunks: the chunk's input is written
+// into the ring first, which allows delays below a sample even when
+// the input and output are the same buffer. Then the delays of the
+// chunk are turned into positions, the taps are gathered, and the
+// interpolation is computed over the whole chunk. Only the gathering
+// and the allpass recursion cannot be vectorized.
+
+#define DELAY_LINE_CHUNK 64
+// The cubic interpolation reaches two samples past the delay.
+#define DELAY_LINE_TAPS 4
+
+struct delay_line_segment_data{
+  struct mixed_buffer *in;
+  struct mixed_buffer *time_in;
+  struct mixed_buffer *out;
+  struct ring_data ring;
+  float time;
+  float target;
+  float max_time;
+  // The last output of the allpass interpolation.
+  float allpass;
+  size_t samplerate;
+  enum mixed_delay_interpolation interpolation;
+};
+
+static int resize_delay_line(float max_time, size_t samplerate, struct delay_line_segment_data *data){
+  size_t needed = ceil(max_time * samplerate) + DELAY_LINE_CHUNK + DELAY_LINE_TAPS;
+  size_t size = 1;
+  while(size < needed) size *= 2;
+  if(!ring_resize(size, &data->ring)){
+    return 0;
+  }
+  ring_clear(&data->ring);
+  data->allpass = 0.0;
+  data->max_time = max_time;
+  data->samplerate = samplerate;
+  if(max_time < data->target) data->target = max_time;
+  if(max_time < data->time) data->time = max_time;
+  return 1;
+}
+
+int delay_line_segment_free(struct mixed_segment *segment){
+  if(segment->data){
+    free_ring_data(&((struct delay_line_segment_data *)segment->data)->ring);
+    free(segment->data);
+  }
+  segment->data = 0;
+  return 1;
+}
+
+int delay_line_segment_start(struct mixed_segment *segment){
+  struct delay_line_segment_data *data = (struct delay_line_segment_data *)segment->data;
+  ring_clear(&data->ring);
+  data->allpass = 0.0;
+  data->time = data->target;
+  return 1;
+}
+
+int delay_line_segment_set_in(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
+  struct delay_line_segment_data *data = (struct delay_line_segment_data *)segment->data;
+
+  switch(field){
+  case MIXED_BUFFER:
+    switch(location){
+    case 0: data->in = (struct mixed_buffer *)buffer; return 1;
+    case 1: data->time_in = (struct mixed_buffer *)buffer; return 1;
+    default: mixed_err(MIXED_INVALID_LOCATION); return 0;
+    }
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+}
+
+int delay_line_segment_set_out(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
+  struct delay_line_segment_data *data = (struct delay_line_segment_data *)segment->data;
+
+  switch(field){
+  case MIXED_BUFFER:
+    if(location == 0){
+      data->out = (struct mixed_buffer *)buffer;
+      return 1;
+    }
+    mixed_err(MIXED_INVALID_LOCATION);
+    return 0;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+}
+
+// Interpolates the chunk whose first sample sits at the position now in
+// the ring, from the delays of its samples.
+static void delay_line_linear(const float *restrict delay, size_t now, struct ring_data *ring, float *restrict out){
+  float *line = ring->data;
+  size_t mask = ring->size-1;
+  int whole[DELAY_LINE_CHUNK];
+  float frac[DELAY_LINE_CHUNK], x0[DELAY_LINE_CHUNK], x1[DELAY_LINE_CHUNK];
+
+  for(int t=0; t<DELAY_LINE_CHUNK; ++t){
+    whole[t] = (int)delay[t];
+    frac[t] = delay[t] - (float)whole[t];
+  }
+  for(int t=0; t<DELAY_LINE_CHUNK; ++t){
+    size_t p = now + t - whole[t];
+    x0[t] = line[p & mask];
+    x1[t] = line[(p-1) & mask];
+  }
+  for(int t=0; t<DELAY_LINE_CHUNK; ++t){
+    out[t] = x0[t] + frac[t]*(x1[t] - x0[t]);
+  }
+}
+
+static void delay_line_cubic(const float *restrict delay, size_t now, struct ring_data *ring, float *restrict out){
+  float *line = ring->data;
+  size_t mask = ring->size-1;
+  int whole[DELAY_LINE_CHUNK];
+  float frac[DELAY_LINE_CHUNK];
+  float xm[DELAY_LINE_CHUNK], x0[DELAY_LINE_CHUNK], x1[DELAY_LINE_CHUNK], x2[DELAY_LINE_CHUNK];
+
+  for(int t=0; t<DELAY_LINE_CHUNK; ++t){
+    whole[t] = (int)delay[t];
+    frac[t] = delay[t] - (float)whole[t];
+  }
+  for(int t=0; t<DELAY_LINE_CHUNK; ++t){
+    size_t p = now + t - whole[t];
+    xm[t] = line[(p+1) & mask];
+    x0[t] = line[p & mask];
+    x1[t] = line[(p-1) & mask];
+    x2[t] = line[(p-2) & mask];
+  }
+  for(int t=0; t<DELAY_LINE_CHUNK; ++t){
+    float c1 = 0.5f*(x1[t] - xm[t]);
+    float c2 = xm[t] - 2.5f*x0[t] + 2.0f*x1[t] - 0.5f*x2[t];
+    float c3 = 0.5f*(x2[t] - xm[t]) + 1.5f*(x0[t] - x1[t]);
+    float f = frac[t];
+    out[t] = ((c3*f + c2)*f + c1)*f + x0[t];
+  }
+}
+
+static void delay_line_allpass(const float *restrict delay, size_t now, struct ring_data *ring, float y, float *restrict out){
+  float *line = ring->data;
+  size_t mask = ring->size-1;
+  int whole[DELAY_LINE_CHUNK];
+  float a[DELAY_LINE_CHUNK], x0[DELAY_LINE_CHUNK], x1[DELAY_LINE_CHUNK];
+
+  for(int t=0; t<DELAY_LINE_CHUNK; ++t){
+    // Keeping the fraction within [0.618, 1.618) keeps the pole of the
+    // allpass away from nyquist, where it would ring.
+    whole[t] = (int)(delay[t] - 0.618f);
+    float f = delay[t] - (float)whole[t];
+    a[t] = (1.0f - f)/(1.0f + f);
+  }
+  for(int t=0; t<DELAY_LINE_CHUNK; ++t){
+    size_t p = now + t - whole[t];
+    x0[t] = line[p & mask];
+    x1[t] = line[(p-1) & mask];
+  }
+  for(int t=0; t<DELAY_LINE_CHUNK; ++t){
+    y = a[t]*x0[t] + x1[t] - a[t]*y;
+    out[t] = y;
+  }
+}
+
+int delay_line_segment_mix(size_t samples, struct mixed_segment *segment){
+  struct delay_line_segment_data *data = (struct delay_line_segment_data *)segment->data;
+  if(samples == 0) return 1;
+
+  struct ring_data *ring = &data->ring;
+  float *in = data->in->data;
+  float *out = data->out->data;
+  float *time = (data->time_in)? data->time_in->data : 0;
+  float samplerate = data->samplerate;
+  float min = (data->interpolation == MIXED_DELAY_LINEAR)? 0.0f : 1.0f;
+  float max = data->max_time * samplerate;
+  // Without a control buffer the delay is ramped towards its target
+  // over the course of the block.
+  float from = data->time;
+  float step = (data->target - from)/samples;
+  float delay[DELAY_LINE_CHUNK];
+  float wave[DELAY_LINE_CHUNK];
+
+  for(size_t i=0; i<samples; i+=DELAY_LINE_CHUNK){
+    size_t chunk = smin(samples-i, DELAY_LINE_CHUNK);
+    // The delays are read before the output is written, in case they
+    // share a buffer.
+    if(time){
+      memcpy(delay, time+i, chunk*sizeof(float));
+      for(size_t t=chunk; t<DELAY_LINE_CHUNK; ++t){
+        delay[t] = delay[chunk-1];
+      }
+    }else{
+      float start = from + step*i;
+      for(int t=0; t<DELAY_LINE_CHUNK; ++t){
+        delay[t] = start + step*(t+1);
+      }
+    }
+    for(int t=0; t<DELAY_LINE_CHUNK; ++t){
+      float d = delay[t]*samplerate;
+      delay[t] = (d < min)? min : (max < d)? max : d;
+    }
+
+    ring_write(in+i, chunk, ring);
+    size_t now = ring->index - chunk;
+    switch(data->interpolation){
+    case MIXED_DELAY_LINEAR: delay_line_linear(delay, now, ring, wave); break;
+    case MIXED_DELAY_CUBIC: delay_line_cubic(delay, now, ring, wave); break;
+    case MIXED_DELAY_ALLPASS:
+      delay_line_allpass(delay, now, ring, data->allpass, wave);
+      data->allpass = wave[chunk-1];
+      break;
+    }
+    memcpy(out+i, wave, chunk*sizeof(float));
+  }
+
+  // The control buffer may have been overwritten by the output, so the
+  // last delay of the final chunk is remembered instead.
+  data->time = delay[(samples-1) % DELAY_LINE_CHUNK] / samplerate;
+  return 1;
+}
+
+int delay_line_segment_mix_bypass(size_t samples, struct mixed_segment *segment){
+  struct delay_line_segment_data *data = (struct delay_line_segment_data *)segment->data;
+
+  return mixed_buffer_copy(data->in, data->out);
+}
+
+int delay_line_segment_info(struct mixed_segment_info *info, struct mixed_segment *segment){
+  info->name = "delay_line";
+  info->description = "Delay the output by a modulated, fractional time.";
+  info->flags = MIXED_INPLACE;
+  info->min_inputs = 1;
+  info->max_inputs = 2;
+  info->outputs = 1;
+
+  struct mixed_segment_field_info *field = info->fields;
+  set_info_field(field++, MIXED_BUFFER,
+                 MIXED_BUFFER_POINTER, 1, MIXED_IN | MIXED_OUT | MIXED_SET,
+                 "The buffer for audio data attached to the location. Input 1 is the optional delay time in seconds.");
+
+  set_info_field(field++, MIXED_DELAY_TIME,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The time, in seconds, by which the output is delayed.");
+
+  set_info_field(field++, MIXED_DELAY_MAX_TIME,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The longest time, in seconds, by which the output can be delayed.");
+
+  set_info_field(field++, MIXED_DELAY_INTERPOLATION,
+                 MIXED_DELAY_INTERPOLATION_ENUM, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "How samples are interpolated for fractional delays.");
+
+  set_info_field(field++, MIXED_SAMPLERATE,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The samplerate at which the segment operates.");
+
+  set_info_field(field++, MIXED_BYPASS,
+                 MIXED_BOOL, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "Bypass the segment's processing.");
+
+  clear_info_field(field++);
+  return 1;
+}
+
+int delay_line_segment_get(size_t field, void *value, struct mixed_segment *segment){
+  struct delay_line_segment_data *data = (struct delay_line_segment_data *)segment->data;
+  switch(field){
+  case MIXED_DELAY_TIME: *((float *)value) = data->target; break;
+  case MIXED_DELAY_MAX_TIME: *((float *)value) = data->max_time; break;
+  case MIXED_DELAY_INTERPOLATION: *((enum mixed_delay_interpolation *)value) = data->interpolation; break;
+  case MIXED_SAMPLERATE: *((size_t *)value) = data->samplerate; break;
+  case MIXED_BYPASS: *((bool *)value) = (segment->mix == delay_line_segment_mix_bypass); break;
+  default: mixed_err(MIXED_INVALID_FIELD); return 0;
+  }
+  return 1;
+}
+
+int delay_line_segment_set(size_t field, void *value, struct mixed_segment *segment){
+  struct delay_line_segment_data *data = (struct delay_line_segment_data *)segment->data;
+  switch(field){
+  case MIXED_DELAY_TIME:
+    if(*(float *)value < 0.0 || data->max_time < *(float *)value){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->target = *(float *)value;
+    break;
+  case MIXED_DELAY_MAX_TIME:
+    if(*(float *)value < 0.0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    return resize_delay_line(*(float *)value, data->samplerate, data);
+  case MIXED_DELAY_INTERPOLATION:
+    if(*(enum mixed_delay_interpolation *)value < MIXED_DELAY_LINEAR ||
+       MIXED_DELAY_CUBIC < *(enum mixed_delay_interpolation *)value){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->interpolation = *(enum mixed_delay_interpolation *)value;
+    break;
+  case MIXED_SAMPLERATE:
+    if(*(size_t *)value <= 0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    return resize_delay_line(data->max_time, *(size_t *)value, data);
+  case MIXED_BYPASS:
+    if(*(bool *)value){
+      segment->mix = delay_line_segment_mix_bypass;
+    }else{
+      segment->mix = delay_line_segment_mix;
+    }
+    break;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+  return 1;
+}
+
+MIXED_EXPORT int mixed_make_segment_delay_line(float max_time, size_t samplerate, struct mixed_segment *segment){
+  if(max_time < 0.0 || samplerate == 0){
+    mixed_err(MIXED_INVALID_VALUE);
+    return 0;
+  }
+
+  struct delay_line_segment_data *data = calloc(1, sizeof(struct delay_line_segment_data));
+  if(!data){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    return 0;
+  }
+
+  data->interpolation = MIXED_DELAY_LINEAR;
+  if(!resize_delay_line(max_time, samplerate, data)){
+    free(data);
+    return 0;
+  }
+
+  segment->free = delay_line_segment_free;
+  segment->start = delay_line_segment_start;
+  segment->mix = delay_line_segment_mix;
+  segment->set_in = delay_line_segment_set_in;
+  segment->set_out = delay_line_segment_set_out;
+  segment->info = delay_line_segment_info;
+  segment->get = delay_line_segment_get;
+  segment->set = delay_line_segment_set;
+  segment->data = data;
+  return 1;
+}
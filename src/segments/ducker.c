@@ -0,0 +1,275 @@
+#include "internal.h"
+
+// Lowers the volume of the program inputs while the key input is loud.
+//
+// The key is only looked at once per mix: its RMS level over the block
+// determines how far the inputs should be lowered, which the reduction
+// follows with the attack or release time. That gives one gain per
+// block, to which the gain is ramped linearly over the block, so that
+// changes do not click.
+
+struct ducker_segment_data{
+  struct mixed_buffer *key;
+  struct mixed_buffer **in;
+  struct mixed_buffer **out;
+  size_t programs;
+  float reduction;
+  float gain;
+  float threshold;
+  float depth;
+  float attack;
+  float release;
+  size_t samplerate;
+};
+
+int ducker_segment_free(struct mixed_segment *segment){
+  struct ducker_segment_data *data = (struct ducker_segment_data *)segment->data;
+  if(data){
+    if(data->in)
+      free(data->in);
+    if(data->out)
+      free(data->out);
+    free(data);
+  }
+  segment->data = 0;
+  return 1;
+}
+
+int ducker_segment_start(struct mixed_segment *segment){
+  struct ducker_segment_data *data = (struct ducker_segment_data *)segment->data;
+  data->reduction = 0.0;
+  data->gain = 1.0;
+  return 1;
+}
+
+int ducker_segment_set_in(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
+  struct ducker_segment_data *data = (struct ducker_segment_data *)segment->data;
+
+  switch(field){
+  case MIXED_BUFFER:
+    if(location == 0){
+      data->key = (struct mixed_buffer *)buffer;
+      return 1;
+    }
+    if(location <= data->programs){
+      data->in[location-1] = (struct mixed_buffer *)buffer;
+      return 1;
+    }
+    mixed_err(MIXED_INVALID_LOCATION);
+    return 0;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+}
+
+int ducker_segment_set_out(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
+  struct ducker_segment_data *data = (struct ducker_segment_data *)segment->data;
+
+  switch(field){
+  case MIXED_BUFFER:
+    if(location < data->programs){
+      data->out[location] = (struct mixed_buffer *)buffer;
+      return 1;
+    }
+    mixed_err(MIXED_INVALID_LOCATION);
+    return 0;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+}
+
+static float block_coefficient(float time, size_t samples, size_t samplerate){
+  return (0.0 < time)? 1.0-exp(-(float)samples/(time*samplerate)) : 1.0;
+}
+
+int ducker_segment_mix(size_t samples, struct mixed_segment *segment){
+  struct ducker_segment_data *data = (struct ducker_segment_data *)segment->data;
+  if(samples == 0) return 1;
+
+  float *key = data->key->data;
+  float energy = 0.0;
+  for(size_t i=0; i<samples; ++i){
+    energy += key[i]*key[i];
+  }
+  float level = sqrtf(energy/samples);
+
+  // The inputs are lowered by as much as the key exceeds the threshold.
+  float reduction = 0.0;
+  if(data->threshold < level){
+    reduction = linear_to_db(level/data->threshold);
+    if(data->depth < reduction) reduction = data->depth;
+  }
+  float time = (data->reduction < reduction)? data->attack : data->release;
+  data->reduction += block_coefficient(time, samples, data->samplerate)*(reduction - data->reduction);
+  float target = db_to_linear(-data->reduction);
+
+  float from = data->gain;
+  float step = (target - from)/samples;
+  for(size_t p=0; p<data->programs; ++p){
+    float *in = data->in[p]->data;
+    float *out = data->out[p]->data;
+    for(size_t i=0; i<samples; ++i){
+      out[i] = in[i]*(from + step*i);
+    }
+  }
+  data->gain = target;
+  return 1;
+}
+
+int ducker_segment_mix_bypass(size_t samples, struct mixed_segment *segment){
+  struct ducker_segment_data *data = (struct ducker_segment_data *)segment->data;
+
+  for(size_t p=0; p<data->programs; ++p){
+    mixed_buffer_copy(data->in[p], data->out[p]);
+  }
+  return 1;
+}
+
+int ducker_segment_info(struct mixed_segment_info *info, struct mixed_segment *segment){
+  struct ducker_segment_data *data = (struct ducker_segment_data *)segment->data;
+  info->name = "ducker";
+  info->description = "Lower the volume of the inputs while a key input is loud.";
+  info->flags = MIXED_INPLACE;
+  info->min_inputs = data->programs+1;
+  info->max_inputs = data->programs+1;
+  info->outputs = data->programs;
+
+  struct mixed_segment_field_info *field = info->fields;
+  set_info_field(field++, MIXED_BUFFER,
+                 MIXED_BUFFER_POINTER, 1, MIXED_IN | MIXED_OUT | MIXED_SET,
+                 "The buffer for audio data attached to the location. Input 0 is the key.");
+
+  set_info_field(field++, MIXED_DUCKER_THRESHOLD,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The level of the key in dB above which the inputs are lowered.");
+
+  set_info_field(field++, MIXED_DUCKER_DEPTH,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The maximal reduction of the inputs in dB.");
+
+  set_info_field(field++, MIXED_DUCKER_ATTACK,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The time in seconds the reduction takes to follow a rising key.");
+
+  set_info_field(field++, MIXED_DUCKER_RELEASE,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The time in seconds the reduction takes to follow a falling key.");
+
+  set_info_field(field++, MIXED_DUCKER_REDUCTION,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_GET,
+                 "The current reduction of the inputs in dB.");
+
+  set_info_field(field++, MIXED_SAMPLERATE,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The samplerate at which the segment operates.");
+
+  set_info_field(field++, MIXED_BYPASS,
+                 MIXED_BOOL, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "Bypass the segment's processing.");
+
+  clear_info_field(field++);
+  return 1;
+}
+
+int ducker_segment_get(size_t field, void *value, struct mixed_segment *segment){
+  struct ducker_segment_data *data = (struct ducker_segment_data *)segment->data;
+  switch(field){
+  case MIXED_DUCKER_THRESHOLD: *((float *)value) = linear_to_db(data->threshold); break;
+  case MIXED_DUCKER_DEPTH: *((float *)value) = data->depth; break;
+  case MIXED_DUCKER_ATTACK: *((float *)value) = data->attack; break;
+  case MIXED_DUCKER_RELEASE: *((float *)value) = data->release; break;
+  case MIXED_DUCKER_REDUCTION: *((float *)value) = data->reduction; break;
+  case MIXED_SAMPLERATE: *((size_t *)value) = data->samplerate; break;
+  case MIXED_BYPASS: *((bool *)value) = (segment->mix == ducker_segment_mix_bypass); break;
+  default: mixed_err(MIXED_INVALID_FIELD); return 0;
+  }
+  return 1;
+}
+
+int ducker_segment_set(size_t field, void *value, struct mixed_segment *segment){
+  struct ducker_segment_data *data = (struct ducker_segment_data *)segment->data;
+  switch(field){
+  case MIXED_DUCKER_THRESHOLD:
+    data->threshold = db_to_linear(*(float *)value);
+    break;
+  case MIXED_DUCKER_DEPTH:
+    if(*(float *)value < 0.0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->depth = *(float *)value;
+    break;
+  case MIXED_DUCKER_ATTACK:
+    if(*(float *)value < 0.0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->attack = *(float *)value;
+    break;
+  case MIXED_DUCKER_RELEASE:
+    if(*(float *)value < 0.0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->release = *(float *)value;
+    break;
+  case MIXED_SAMPLERATE:
+    if(*(size_t *)value <= 0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->samplerate = *(size_t *)value;
+    break;
+  case MIXED_BYPASS:
+    if(*(bool *)value){
+      segment->mix = ducker_segment_mix_bypass;
+    }else{
+      segment->mix = ducker_segment_mix;
+    }
+    break;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+  return 1;
+}
+
+MIXED_EXPORT int mixed_make_segment_ducker(size_t programs, size_t samplerate, struct mixed_segment *segment){
+  struct ducker_segment_data *data = calloc(1, sizeof(struct ducker_segment_data));
+  if(!data){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    return 0;
+  }
+
+  data->in = calloc(programs, sizeof(struct mixed_buffer *));
+  data->out = calloc(programs, sizeof(struct mixed_buffer *));
+  if(!data->in || !data->out){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    if(data->in) free(data->in);
+    if(data->out) free(data->out);
+    free(data);
+    return 0;
+  }
+
+  data->programs = programs;
+  data->samplerate = samplerate;
+  data->threshold = db_to_linear(-40.0);
+  data->depth = 12.0;
+  data->attack = 0.05;
+  data->release = 0.5;
+  data->reduction = 0.0;
+  data->gain = 1.0;
+
+  segment->free = ducker_segment_free;
+  segment->start = ducker_segment_start;
+  segment->mix = ducker_segment_mix;
+  segment->set_in = ducker_segment_set_in;
+  segment->set_out = ducker_segment_set_out;
+  segment->info = ducker_segment_info;
+  segment->get = ducker_segment_get;
+  segment->set = ducker_segment_set;
+  segment->data = data;
+  return 1;
+}
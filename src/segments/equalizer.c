@@ -0,0 +1,313 @@
+#include "internal.h"
+
+// Every band is one section of a biquad cascade that is run over all
+// channels at once. The band parameters are only turned into
+// coefficients at the start of a mix, so that a burst of changes costs
+// one update and the cascade never changes in the middle of a block.
+
+#define EQUALIZER_MAX_BANDS 16
+
+struct equalizer_segment_data{
+  struct mixed_buffer **in;
+  struct mixed_buffer **out;
+  struct biquad_data biquad;
+  struct mixed_equalizer_band bands[EQUALIZER_MAX_BANDS];
+  size_t count;
+  size_t channels;
+  size_t samplerate;
+  bool changed;
+};
+
+static void compute_band(struct mixed_equalizer_band *band, size_t samplerate, struct biquad_coefficients *c){
+  switch(band->filter){
+  case MIXED_EQUALIZER_PEAK:
+    biquad_peak(band->frequency, band->q, band->gain, samplerate, c);
+    break;
+  case MIXED_EQUALIZER_LOW_SHELF:
+    biquad_low_shelf(band->frequency, band->q, band->gain, samplerate, c);
+    break;
+  case MIXED_EQUALIZER_HIGH_SHELF:
+    biquad_high_shelf(band->frequency, band->q, band->gain, samplerate, c);
+    break;
+  case MIXED_EQUALIZER_LOW_PASS:
+    biquad_lowpass(band->frequency, band->q, samplerate, c);
+    break;
+  case MIXED_EQUALIZER_HIGH_PASS:
+    biquad_highpass(band->frequency, band->q, samplerate, c);
+    break;
+  }
+}
+
+// Whether the first count bands all lie below nyquist. Bands may have
+// been set at a different samplerate than the one they are used at.
+static bool bands_below_nyquist(size_t count, size_t samplerate, struct equalizer_segment_data *data){
+  for(size_t i=0; i<count; ++i){
+    if(samplerate <= 2*data->bands[i].frequency)
+      return 0;
+  }
+  return 1;
+}
+
+static void update_bands(struct equalizer_segment_data *data){
+  if(data->biquad.count != data->count){
+    biquad_resize(data->count, &data->biquad);
+  }
+  for(size_t i=0; i<data->count; ++i){
+    compute_band(&data->bands[i], data->samplerate, &data->biquad.sections[i]);
+  }
+  data->changed = 0;
+}
+
+int equalizer_segment_free(struct mixed_segment *segment){
+  struct equalizer_segment_data *data = (struct equalizer_segment_data *)segment->data;
+  if(data){
+    free_biquad_data(&data->biquad);
+    if(data->in)
+      free(data->in);
+    if(data->out)
+      free(data->out);
+    free(data);
+  }
+  segment->data = 0;
+  return 1;
+}
+
+int equalizer_segment_start(struct mixed_segment *segment){
+  struct equalizer_segment_data *data = (struct equalizer_segment_data *)segment->data;
+  update_bands(data);
+  biquad_clear(&data->biquad);
+  return 1;
+}
+
+int equalizer_segment_set_in(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
+  struct equalizer_segment_data *data = (struct equalizer_segment_data *)segment->data;
+
+  switch(field){
+  case MIXED_BUFFER:
+    if(location < data->channels){
+      data->in[location] = (struct mixed_buffer *)buffer;
+      return 1;
+    }
+    mixed_err(MIXED_INVALID_LOCATION);
+    return 0;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+}
+
+int equalizer_segment_set_out(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
+  struct equalizer_segment_data *data = (struct equalizer_segment_data *)segment->data;
+
+  switch(field){
+  case MIXED_BUFFER:
+    if(location < data->channels){
+      data->out[location] = (struct mixed_buffer *)buffer;
+      return 1;
+    }
+    mixed_err(MIXED_INVALID_LOCATION);
+    return 0;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+}
+
+// Changes the number of channels, which clears the filter state.
+static int resize_equalizer_channels(size_t channels, struct equalizer_segment_data *data){
+  struct biquad_data biquad = {0};
+  if(!make_biquad_data(channels, EQUALIZER_MAX_BANDS, &biquad)){
+    return 0;
+  }
+  struct mixed_buffer **in = crealloc(data->in, data->channels, channels, sizeof(struct mixed_buffer *));
+  if(in) data->in = in;
+  struct mixed_buffer **out = crealloc(data->out, data->channels, channels, sizeof(struct mixed_buffer *));
+  if(out) data->out = out;
+  if(!in || !out){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    free_biquad_data(&biquad);
+    return 0;
+  }
+  free_biquad_data(&data->biquad);
+  data->biquad = biquad;
+  data->channels = channels;
+  update_bands(data);
+  return 1;
+}
+
+int equalizer_segment_mix(size_t samples, struct mixed_segment *segment){
+  struct equalizer_segment_data *data = (struct equalizer_segment_data *)segment->data;
+
+  if(data->changed){
+    update_bands(data);
+  }
+  if(data->count == 0){
+    for(size_t c=0; c<data->channels; ++c){
+      mixed_buffer_copy(data->in[c], data->out[c]);
+    }
+  }else{
+    biquad_process(data->in, data->out, samples, &data->biquad);
+  }
+  return 1;
+}
+
+int equalizer_segment_mix_bypass(size_t samples, struct mixed_segment *segment){
+  struct equalizer_segment_data *data = (struct equalizer_segment_data *)segment->data;
+
+  for(size_t c=0; c<data->channels; ++c){
+    mixed_buffer_copy(data->in[c], data->out[c]);
+  }
+  return 1;
+}
+
+int equalizer_segment_info(struct mixed_segment_info *info, struct mixed_segment *segment){
+  struct equalizer_segment_data *data = (struct equalizer_segment_data *)segment->data;
+
+  info->name = "equalizer";
+  info->description = "A parametric equalizer.";
+  info->flags = MIXED_INPLACE;
+  info->min_inputs = data->channels;
+  info->max_inputs = data->channels;
+  info->outputs = data->channels;
+
+  struct mixed_segment_field_info *field = info->fields;
+  set_info_field(field++, MIXED_BUFFER,
+                 MIXED_BUFFER_POINTER, 1, MIXED_IN | MIXED_OUT | MIXED_SET,
+                 "The buffer for audio data attached to the location.");
+
+  set_info_field(field++, MIXED_EQUALIZER_BANDS,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The number of active bands.");
+
+  set_info_field(field++, MIXED_EQUALIZER_BAND,
+                 MIXED_EQUALIZER_BAND_POINTER, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The parameters of the band selected by the index.");
+
+  set_info_field(field++, MIXED_CHANNELS,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The number of channels that are equalized.");
+
+  set_info_field(field++, MIXED_SAMPLERATE,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The samplerate at which the segment operates.");
+
+  set_info_field(field++, MIXED_BYPASS,
+                 MIXED_BOOL, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "Bypass the segment's processing.");
+
+  clear_info_field(field++);
+  return 1;
+}
+
+int equalizer_segment_get(size_t field, void *value, struct mixed_segment *segment){
+  struct equalizer_segment_data *data = (struct equalizer_segment_data *)segment->data;
+  switch(field){
+  case MIXED_EQUALIZER_BANDS: *((size_t *)value) = data->count; break;
+  case MIXED_EQUALIZER_BAND: {
+    struct mixed_equalizer_band *band = (struct mixed_equalizer_band *)value;
+    if(EQUALIZER_MAX_BANDS <= band->index){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    *band = data->bands[band->index];
+  } break;
+  case MIXED_CHANNELS: *((size_t *)value) = data->channels; break;
+  case MIXED_SAMPLERATE: *((size_t *)value) = data->samplerate; break;
+  case MIXED_BYPASS: *((bool *)value) = (segment->mix == equalizer_segment_mix_bypass); break;
+  default: mixed_err(MIXED_INVALID_FIELD); return 0;
+  }
+  return 1;
+}
+
+int equalizer_segment_set(size_t field, void *value, struct mixed_segment *segment){
+  struct equalizer_segment_data *data = (struct equalizer_segment_data *)segment->data;
+  switch(field){
+  case MIXED_EQUALIZER_BANDS:
+    if(EQUALIZER_MAX_BANDS < *(size_t *)value
+       || !bands_below_nyquist(*(size_t *)value, data->samplerate, data)){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->count = *(size_t *)value;
+    data->changed = 1;
+    break;
+  case MIXED_EQUALIZER_BAND: {
+    struct mixed_equalizer_band *band = (struct mixed_equalizer_band *)value;
+    if(EQUALIZER_MAX_BANDS <= band->index
+       || band->filter < MIXED_EQUALIZER_PEAK || MIXED_EQUALIZER_HIGH_PASS < band->filter
+       || band->frequency <= 0.0 || data->samplerate <= 2*band->frequency
+       || band->q <= 0.0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->bands[band->index] = *band;
+    data->changed = 1;
+  } break;
+  case MIXED_CHANNELS:
+    if(*(size_t *)value == 0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    return resize_equalizer_channels(*(size_t *)value, data);
+  case MIXED_SAMPLERATE:
+    if(*(size_t *)value <= 0
+       || !bands_below_nyquist(data->count, *(size_t *)value, data)){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->samplerate = *(size_t *)value;
+    data->changed = 1;
+    break;
+  case MIXED_BYPASS:
+    if(*(bool *)value){
+      segment->mix = equalizer_segment_mix_bypass;
+    }else{
+      segment->mix = equalizer_segment_mix;
+    }
+    break;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+  return 1;
+}
+
+MIXED_EXPORT int mixed_make_segment_equalizer(size_t channels, size_t samplerate, struct mixed_segment *segment){
+  if(channels == 0 || samplerate == 0){
+    mixed_err(MIXED_INVALID_VALUE);
+    return 0;
+  }
+
+  struct equalizer_segment_data *data = calloc(1, sizeof(struct equalizer_segment_data));
+  if(!data){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    return 0;
+  }
+
+  data->samplerate = samplerate;
+  for(size_t i=0; i<EQUALIZER_MAX_BANDS; ++i){
+    data->bands[i].index = i;
+    data->bands[i].filter = MIXED_EQUALIZER_PEAK;
+    data->bands[i].frequency = 1000.0;
+    data->bands[i].gain = 0.0;
+    data->bands[i].q = M_SQRT1_2;
+  }
+
+  if(!resize_equalizer_channels(channels, data)){
+    if(data->in) free(data->in);
+    if(data->out) free(data->out);
+    free(data);
+    return 0;
+  }
+
+  segment->free = equalizer_segment_free;
+  segment->start = equalizer_segment_start;
+  segment->mix = equalizer_segment_mix;
+  segment->set_in = equalizer_segment_set_in;
+  segment->set_out = equalizer_segment_set_out;
+  segment->info = equalizer_segment_info;
+  segment->get = equalizer_segment_get;
+  segment->set = equalizer_segment_set;
+  segment->data = data;
+  return 1;
+}
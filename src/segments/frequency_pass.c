@@ -1,36 +1,34 @@
 #include "internal.h"
 
 struct frequency_pass_segment_data{
-  struct mixed_buffer *in;
-  struct mixed_buffer *out;
-  float x[2];
-  float y[2];
-  float a[2];
-  float b[2];
-  float k;
+  struct mixed_buffer **in;
+  struct mixed_buffer **out;
+  struct biquad_data biquad;
+  size_t channels;
   size_t cutoff;
   size_t samplerate;
   enum mixed_frequency_pass pass;
 };
 
+// Second-order Butterworth filters. The state is kept, so that the
+// cutoff can be changed while mixing.
 void compute_coefficients(struct frequency_pass_segment_data *data){
-  float a = tan(M_PI*data->cutoff/data->samplerate);
-  float a2 = a*a;
-  float s2 = sqrt(2);
-  data->k = (a2)/(1+s2*a+a2);
-  data->a[0] = (2*(a2-1))/(1+s2*a+a2);
-  data->a[1] = (1-s2*a+a2)/(1+s2*a+a2);
-  data->b[0] = 2;
-  data->b[1] = 1;
-  data->x[0] = 0;
-  data->x[1] = 0;
-  data->y[0] = 0;
-  data->y[1] = 0;
+  if(data->pass == MIXED_PASS_LOW){
+    biquad_lowpass(data->cutoff, M_SQRT1_2, data->samplerate, &data->biquad.sections[0]);
+  }else{
+    biquad_highpass(data->cutoff, M_SQRT1_2, data->samplerate, &data->biquad.sections[0]);
+  }
 }
 
 int frequency_pass_segment_free(struct mixed_segment *segment){
-  if(segment->data){
-    free(segment->data);
+  struct frequency_pass_segment_data *data = (struct frequency_pass_segment_data *)segment->data;
+  if(data){
+    free_biquad_data(&data->biquad);
+    if(data->in)
+      free(data->in);
+    if(data->out)
+      free(data->out);
+    free(data);
   }
   segment->data = 0;
   return 1;
@@ -40,10 +38,7 @@ int frequency_pass_segment_free(struct mixed_segment *segment){
 
 int frequency_pass_segment_start(struct mixed_segment *segment){
   struct frequency_pass_segment_data *data = (struct frequency_pass_segment_data *)segment->data;
-  data->x[0] = 0;
-  data->x[1] = 0;
-  data->y[0] = 0;
-  data->y[1] = 0;
+  biquad_clear(&data->biquad);
   return 1;
 }
 
@@ -52,8 +47,8 @@ int frequency_pass_segment_set_in(size_t field, size_t location, void *buffer, s
 
   switch(field){
   case MIXED_BUFFER:
-    if(location == 0){
-      data->in = (struct mixed_buffer *)buffer;
+    if(location < data->channels){
+      data->in[location] = (struct mixed_buffer *)buffer;
       return 1;
     }
     mixed_err(MIXED_INVALID_LOCATION);
@@ -69,8 +64,8 @@ int frequency_pass_segment_set_out(size_t field, size_t location, void *buffer,
 
   switch(field){
   case MIXED_BUFFER:
-    if(location == 0){
-      data->out = (struct mixed_buffer *)buffer;
+    if(location < data->channels){
+      data->out[location] = (struct mixed_buffer *)buffer;
       return 1;
     }
     mixed_err(MIXED_INVALID_LOCATION);
@@ -81,57 +76,42 @@ int frequency_pass_segment_set_out(size_t field, size_t location, void *buffer,
   }
 }
 
-int low_pass_segment_mix(size_t samples, struct mixed_segment *segment){
-  struct frequency_pass_segment_data *data = (struct frequency_pass_segment_data *)segment->data;
-
-  float *in = data->in->data;
-  float *out = data->out->data;
-  float *x = data->x;
-  float *y = data->y;
-  float *a = data->a;
-  float *b = data->b;
-  float k = data->k;
-
-  for(size_t i=0; i<samples; ++i){
-    float s = in[i];
-    out[i] = k*s + k*b[0]*x[0] + k*b[1]*x[1] - a[0]*y[0] - a[1]*y[1];
-    x[1] = x[0];
-    x[0] = s;
-    y[1] = y[0];
-    y[0] = out[i];
+// Changes the number of channels, which clears the filter state.
+static int resize_frequency_pass_channels(size_t channels, struct frequency_pass_segment_data *data){
+  struct biquad_data biquad = {0};
+  if(!make_biquad_data(channels, 1, &biquad)){
+    return 0;
   }
-
+  struct mixed_buffer **in = crealloc(data->in, data->channels, channels, sizeof(struct mixed_buffer *));
+  if(in) data->in = in;
+  struct mixed_buffer **out = crealloc(data->out, data->channels, channels, sizeof(struct mixed_buffer *));
+  if(out) data->out = out;
+  if(!in || !out){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    free_biquad_data(&biquad);
+    return 0;
+  }
+  free_biquad_data(&data->biquad);
+  data->biquad = biquad;
+  data->channels = channels;
+  compute_coefficients(data);
   return 1;
 }
 
-int high_pass_segment_mix(size_t samples, struct mixed_segment *segment){
+int frequency_pass_segment_mix(size_t samples, struct mixed_segment *segment){
   struct frequency_pass_segment_data *data = (struct frequency_pass_segment_data *)segment->data;
 
-  float *in = data->in->data;
-  float *out = data->out->data;
-  float *x = data->x;
-  float *y = data->y;
-  float *a = data->a;
-  float *b = data->b;
-  float k = data->k;
-
-  for(size_t i=0; i<samples; ++i){
-    float s = in[i];
-    out[i] = k*s + k*b[0]*x[0] + k*b[1]*x[1] - a[0]*y[0] - a[1]*y[1];
-    x[1] = x[0];
-    x[0] = s;
-    y[1] = y[0];
-    y[0] = out[i];
-    out[i] = s-out[i];
-  }
-
+  biquad_process(data->in, data->out, samples, &data->biquad);
   return 1;
 }
 
 int frequency_pass_segment_mix_bypass(size_t samples, struct mixed_segment *segment){
   struct frequency_pass_segment_data *data = (struct frequency_pass_segment_data *)segment->data;
   
-  return mixed_buffer_copy(data->in, data->out);
+  for(size_t c=0; c<data->channels; ++c){
+    mixed_buffer_copy(data->in[c], data->out[c]);
+  }
+  return 1;
 }
 
 int frequency_pass_segment_info(struct mixed_segment_info *info, struct mixed_segment *segment){
@@ -140,9 +120,9 @@ int frequency_pass_segment_info(struct mixed_segment_info *info, struct mixed_se
   info->name = "frequency_pass";
   info->description = "A frequency filter segment.";
   info->flags = MIXED_INPLACE;
-  info->min_inputs = 1;
-  info->max_inputs = 1;
-  info->outputs = 1;
+  info->min_inputs = data->channels;
+  info->max_inputs = data->channels;
+  info->outputs = data->channels;
     
   struct mixed_segment_field_info *field = info->fields;
   set_info_field(field++, MIXED_BUFFER,
@@ -157,6 +137,10 @@ int frequency_pass_segment_info(struct mixed_segment_info *info, struct mixed_se
                  MIXED_FREQUENCY_PASS_ENUM, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
                  "Whether to pass high or low frequencies.");
 
+  set_info_field(field++, MIXED_CHANNELS,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The number of channels that are filtered.");
+
   set_info_field(field++, MIXED_SAMPLERATE,
                  MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
                  "The samplerate at which the segment operates.");
@@ -175,6 +159,7 @@ int frequency_pass_segment_get(size_t field, void *value, struct mixed_segment *
   case MIXED_SAMPLERATE: *((size_t *)value) = data->samplerate; break;
   case MIXED_FREQUENCY_CUTOFF: *((size_t *)value) = data->cutoff; break;
   case MIXED_FREQUENCY_PASS: *((enum mixed_frequency_pass *)value) = data->pass; break;
+  case MIXED_CHANNELS: *((size_t *)value) = data->channels; break;
   case MIXED_BYPASS: *((bool *)value) = (segment->mix == frequency_pass_segment_mix_bypass); break;
   default: mixed_err(MIXED_INVALID_FIELD); return 0;
   }
@@ -207,18 +192,19 @@ int frequency_pass_segment_set(size_t field, void *value, struct mixed_segment *
       return 0;
     }
     data->pass = *(enum mixed_frequency_pass *)value;
-    if(segment->mix != frequency_pass_segment_mix_bypass){
-      segment->mix = (data->pass == MIXED_PASS_LOW)
-        ? low_pass_segment_mix
-        : high_pass_segment_mix;
+    compute_coefficients(data);
+    break;
+  case MIXED_CHANNELS:
+    if(*(size_t *)value == 0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
     }
+    return resize_frequency_pass_channels(*(size_t *)value, data);
   case MIXED_BYPASS:
     if(*(bool *)value){
       segment->mix = frequency_pass_segment_mix_bypass;
-    }else if(data->pass == MIXED_PASS_LOW){
-      segment->mix = low_pass_segment_mix;
     }else{
-      segment->mix = high_pass_segment_mix;
+      segment->mix = frequency_pass_segment_mix;
     }
     break;
   default:
@@ -244,11 +230,16 @@ MIXED_EXPORT int mixed_make_segment_frequency_pass(enum mixed_frequency_pass pas
   data->samplerate = samplerate;
   data->pass = pass;
 
-  compute_coefficients(data);
+  if(!resize_frequency_pass_channels(1, data)){
+    if(data->in) free(data->in);
+    if(data->out) free(data->out);
+    free(data);
+    return 0;
+  }
   
   segment->free = frequency_pass_segment_free;
   segment->start = frequency_pass_segment_start;
-  segment->mix = (pass == MIXED_PASS_LOW)? low_pass_segment_mix : high_pass_segment_mix;
+  segment->mix = frequency_pass_segment_mix;
   segment->set_in = frequency_pass_segment_set_in;
   segment->set_out = frequency_pass_segment_set_out;
   segment->info = frequency_pass_segment_info;
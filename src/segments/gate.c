@@ -1,5 +1,7 @@
 #include "internal.h"
 
+#define GATE_WINDOW 32
+
 enum state{
   CLOSED = 1,
   ATTACKING = 2,
@@ -18,7 +20,9 @@ struct gate_segment_data{
   float release;
   size_t samplerate;
   float time;
+  float volume;
   enum state state;
+  enum mixed_gate_detector detector;
 };
 
 float db_to_linear(float db){
@@ -42,6 +46,8 @@ int gate_segment_free(struct mixed_segment *segment){
 int gate_segment_start(struct mixed_segment *segment){
   struct gate_segment_data *data = (struct gate_segment_data *)segment->data;
   data->time = 0.0;
+  data->volume = 0.0;
+  data->state = CLOSED;
   return 1;
 }
 
@@ -79,70 +85,118 @@ int gate_segment_set_out(size_t field, size_t location, void *buffer, struct mix
   }
 }
 
+// The level of the input is measured over short windows, and the state
+// of the gate only changes from one window to the next. Within a window
+// the volume is thus either constant or a linear ramp, which leaves the
+// per-sample work as plain loops without any branches. The loops always
+// run over a full window with eight independent accumulators, so that
+// the compiler can turn them into vector instructions.
+static float window_level(float *x, size_t samples, enum mixed_gate_detector detector){
+  float acc[8] = {0};
+  if(detector == MIXED_GATE_RMS){
+    for(size_t i=0; i<GATE_WINDOW; i+=8){
+      for(size_t l=0; l<8; ++l){
+        acc[l] += x[i+l]*x[i+l];
+      }
+    }
+    float sum = (acc[0]+acc[1]+acc[2]+acc[3]) + (acc[4]+acc[5]+acc[6]+acc[7]);
+    return sqrtf(sum/samples);
+  }else{
+    for(size_t i=0; i<GATE_WINDOW; i+=8){
+      for(size_t l=0; l<8; ++l){
+        float sample = fabsf(x[i+l]);
+        acc[l] = (acc[l] < sample)? sample : acc[l];
+      }
+    }
+    for(size_t l=1; l<8; ++l){
+      acc[0] = (acc[0] < acc[l])? acc[l] : acc[0];
+    }
+    return acc[0];
+  }
+}
+
+static void apply_volume(float *x, float *out, size_t samples, float from, float to){
+  if(from == to && from == 0.0){
+    memset(out, 0, samples*sizeof(float));
+  }else if(from == to && from == 1.0){
+    memcpy(out, x, samples*sizeof(float));
+  }else{
+    float step = (to-from)/samples;
+    // An int counter converts to float in vector registers, a size_t not.
+    for(int i=0; i<GATE_WINDOW; ++i){
+      x[i] *= from+step*(i+1);
+    }
+    memcpy(out, x, samples*sizeof(float));
+  }
+}
+
 int gate_segment_mix(size_t samples, struct mixed_segment *segment){
   struct gate_segment_data *data = (struct gate_segment_data *)segment->data;
 
-  float stime = 1.0/data->samplerate;
-  float time = data->time;
   float open = data->open_threshold;
   float close = data->close_threshold;
-  float attack = data->attack;
-  float hold = data->hold;
-  float release = data->release;
   float *in = data->in->data;
   float *out = data->out->data;
-  float volume = 1.0;
-  for(size_t i=0; i<samples; ++i){
-    float sample = in[i];
+  float volume = data->volume;
+  float time = data->time;
+  for(size_t i=0; i<samples; i+=GATE_WINDOW){
+    size_t window = smin(samples-i, GATE_WINDOW);
+    // The window is copied out, which also lets the output share the
+    // input's buffer. A short last window is padded with silence.
+    float x[GATE_WINDOW];
+    memcpy(x, in+i, window*sizeof(float));
+    if(window < GATE_WINDOW){
+      memset(x+window, 0, (GATE_WINDOW-window)*sizeof(float));
+    }
+    float level = window_level(x, window, data->detector);
+    float duration = (float)window/data->samplerate;
+    float from = volume;
     switch(data->state){
     case CLOSED:
-      volume = 0.0;
-      if(open <= sample){
-        time = 0.0;
+      if(open <= level){
         data->state = ATTACKING;
       }
       break;
-    case ATTACKING:
-      if(attack < time){
-        data->state = OPEN;
-      }else{
-        volume = time/attack;
-        time += stime;
-      }
-      break;
     case OPEN:
-      if(sample < close){
-        time = hold;
+      if(level < close){
+        time = data->hold;
         data->state = HOLDING;
       }
       break;
     case HOLDING:
-      if(open <= sample){
+      if(open <= level){
         data->state = OPEN;
-      }else if(time <= 0){
-        time = release;
+      }else if(time <= 0.0){
         data->state = RELEASING;
       }else{
-        time -= stime;
+        time -= duration;
       }
       break;
     case RELEASING:
-      if(open <= sample){
-        volume = time/release;
-        time = time/release*attack;
+      if(open <= level){
         data->state = ATTACKING;
-      }else if(time <= 0){
+      }
+      break;
+    default:
+      break;
+    }
+    // Ramp the volume within the window.
+    if(data->state == ATTACKING){
+      volume = (0.0 < data->attack)? volume + duration/data->attack : 1.0;
+      if(1.0 <= volume){
+        volume = 1.0;
+        data->state = OPEN;
+      }
+    }else if(data->state == RELEASING){
+      volume = (0.0 < data->release)? volume - duration/data->release : 0.0;
+      if(volume <= 0.0){
         volume = 0.0;
-        time = 0.0;
         data->state = CLOSED;
-      }else{
-        volume = time/release;
-        time -= stime;
       }
-      break;
     }
-    out[i] = sample * volume;
+    apply_volume(x, out+i, window, from, volume);
   }
+  data->volume = volume;
   data->time = time;
   return 1;
 }
@@ -188,6 +242,10 @@ int gate_segment_info(struct mixed_segment_info *info, struct mixed_segment *seg
                  MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
                  "The time during which the output volume is scaled down.");
 
+  set_info_field(field++, MIXED_GATE_DETECTOR,
+                 MIXED_GATE_DETECTOR_ENUM, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "How the level of the input is measured.");
+
   set_info_field(field++, MIXED_SAMPLERATE,
                  MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
                  "The samplerate at which the segment operates.");
@@ -208,6 +266,7 @@ int gate_segment_get(size_t field, void *value, struct mixed_segment *segment){
   case MIXED_GATE_ATTACK: *((float *)value) = data->attack; break;
   case MIXED_GATE_HOLD: *((float *)value) = data->hold; break;
   case MIXED_GATE_RELEASE: *((float *)value) = data->release; break;
+  case MIXED_GATE_DETECTOR: *((enum mixed_gate_detector *)value) = data->detector; break;
   case MIXED_SAMPLERATE: *((size_t *)value) = data->samplerate; break;
   case MIXED_BYPASS: *((bool *)value) = (segment->mix == gate_segment_mix_bypass); break;
   default: mixed_err(MIXED_INVALID_FIELD); return 0;
@@ -252,6 +311,14 @@ int gate_segment_set(size_t field, void *value, struct mixed_segment *segment){
     }
     data->release = *(float *)value;
     break;
+  case MIXED_GATE_DETECTOR:
+    if(*(enum mixed_gate_detector *)value < MIXED_GATE_PEAK ||
+       MIXED_GATE_RMS < *(enum mixed_gate_detector *)value){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->detector = *(enum mixed_gate_detector *)value;
+    break;
   case MIXED_BYPASS:
     if(*(bool *)value){
       segment->mix = gate_segment_mix_bypass;
@@ -280,6 +347,7 @@ MIXED_EXPORT int mixed_make_segment_gate(size_t samplerate, struct mixed_segment
   data->hold = 0.2;
   data->release = 0.15;
   data->state = CLOSED;
+  data->detector = MIXED_GATE_PEAK;
   
   segment->free = gate_segment_free;
   segment->start = gate_segment_start;
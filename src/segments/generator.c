@@ -1,17 +1,48 @@
 #include "internal.h"
 
+// The phase is kept in turns and advanced by a fixed step per sample,
+// so that any frequency, including fractional ones, is reproduced
+// without drift, and frequency changes do not jump the phase.
+//
+// The waves are rendered in chunks: the phases of a chunk are computed
+// from its start in one loop, and the wave form in another, so that
+// neither loop carries a dependency from one sample to the next and
+// both vectorize. The discontinuities of the square and sawtooth waves
+// are smoothed with PolyBLEP residuals, and the corners of the triangle
+// wave with the integrated PolyBLAMP residuals, which removes most of
+// the aliasing of the naive wave forms.
+//
+// The partials of the additive generator are processed in lanes of
+// sixteen, each rotating a phasor by its own step per sample. The
+// phasors are set from the exact phases again at every chunk, so the
+// rounding errors of the rotation never build up.
+
+#define GENERATOR_CHUNK 64
+#define GENERATOR_LANES 16
+
 struct generator_segment_data{
   struct mixed_buffer *out;
   enum mixed_generator_type type;
   float frequency;
-  size_t phase;
+  float phase;
   size_t samplerate;
   float volume;
+  bool fast_math;
+  // The partials, padded with silent ones to a multiple of the lanes.
+  float *ratios;
+  float *amplitudes;
+  float *phases;
+  size_t partials;
 };
 
 int generator_segment_free(struct mixed_segment *segment){
-  if(segment->data)
-    free(segment->data);
+  struct generator_segment_data *data = (struct generator_segment_data *)segment->data;
+  if(data){
+    // The partial arrays are carved out of the same allocation.
+    if(data->ratios)
+      free(data->ratios);
+    free(data);
+  }
   segment->data = 0;
   return 1;
 }
@@ -32,57 +63,200 @@ int generator_segment_set_out(size_t field, size_t location, void *buffer, struc
   }
 }
 
-float sine_wave(float frequency, float phase, float samplerate){
-  return sinf(2 * M_PI * frequency * phase / samplerate);
+static inline float wrap_turns(float phase){
+  return phase - (float)(int)phase;
 }
 
-float square_wave(float frequency, float phase, float samplerate){
-  float length = samplerate / frequency;
-  return (fmod(phase, length) < length/2)? 1.0f : -1.0f;
+// The correction for a step of -2 at the phase zero, spread over one
+// sample on either side of it.
+static inline float poly_blep(float t, float dt, float idt){
+  float a = t*idt, b = (t-1.0f)*idt;
+  return (t < dt)? a+a - a*a - 1.0f
+    : (1.0f-dt < t)? b*b + b+b + 1.0f
+    : 0.0f;
 }
 
-float triangle_wave(float frequency, float phase, float samplerate){
-  float length = samplerate / frequency;
-  float temp = fmod(phase, length) / length;
-  float abs  = (0.5 < temp)? 1.0-temp : temp;
-  return abs*4.0 - 1.0;
+// The integral of poly_blep, which corrects a change of slope by 2 per
+// sample at the phase zero.
+static inline float poly_blamp(float t, float dt, float idt){
+  float a = 1.0f - t*idt, b = 1.0f + (t-1.0f)*idt;
+  return (t < dt)? a*a*a*(1.0f/3)
+    : (1.0f-dt < t)? b*b*b*(1.0f/3)
+    : 0.0f;
 }
 
-float sawtooth_wave(float frequency, float phase, float samplerate){
-  float length = samplerate / frequency;
-  return fmod(phase, length) / length * 2.0 - 1.0;
+static void render_wave(enum mixed_generator_type type, bool fast, const float *restrict phases, float dt, float *restrict wave){
+  // The residuals overlap for frequencies close to nyquist.
+  if(0.5f < dt) dt = 0.5f;
+  float idt = 1.0f/dt;
+
+  switch(type){
+  case MIXED_SINE:
+    if(fast){
+      for(int i=0; i<GENERATOR_CHUNK; ++i){
+        // sin(2 Pi t) = -sin(2 Pi t - Pi), which is within +/- Pi.
+        float s, c;
+        fast_sincos(2*(float)M_PI*phases[i] - (float)M_PI, &s, &c);
+        wave[i] = -s;
+      }
+    }else{
+      for(int i=0; i<GENERATOR_CHUNK; ++i){
+        wave[i] = sinf(2*(float)M_PI*phases[i]);
+      }
+    }
+    break;
+  case MIXED_SQUARE:
+    for(int i=0; i<GENERATOR_CHUNK; ++i){
+      float t = phases[i];
+      float u = wrap_turns(t + 0.5f);
+      float naive = (t < 0.5f)? 1.0f : -1.0f;
+      wave[i] = naive + poly_blep(t, dt, idt) - poly_blep(u, dt, idt);
+    }
+    break;
+  case MIXED_TRIANGLE:
+    for(int i=0; i<GENERATOR_CHUNK; ++i){
+      float t = phases[i];
+      float u = wrap_turns(t + 0.5f);
+      float naive = (t < 0.5f)? 4.0f*t - 1.0f : 3.0f - 4.0f*t;
+      // The slope changes by 8 per turn, or 8*dt per sample.
+      wave[i] = naive + 4.0f*dt*(poly_blamp(t, dt, idt) - poly_blamp(u, dt, idt));
+    }
+    break;
+  case MIXED_SAWTOOTH:
+    for(int i=0; i<GENERATOR_CHUNK; ++i){
+      float t = phases[i];
+      wave[i] = 2.0f*t - 1.0f - poly_blep(t, dt, idt);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+// Sums up the partials, whose phases are already advanced to the start
+// of the chunk.
+static void render_partials(struct generator_segment_data *data, float dt, float *restrict wave){
+  float lanes[GENERATOR_CHUNK*GENERATOR_LANES] = {0};
+
+  for(size_t k=0; k<data->partials; k+=GENERATOR_LANES){
+    float c[GENERATOR_LANES], s[GENERATOR_LANES];
+    float rc[GENERATOR_LANES], rs[GENERATOR_LANES];
+    float a[GENERATOR_LANES];
+    for(int l=0; l<GENERATOR_LANES; ++l){
+      float step = data->ratios[k+l]*dt;
+      // Partials beyond nyquist would alias.
+      a[l] = (step < 0.5f)? data->amplitudes[k+l] : 0.0f;
+      if(data->fast_math){
+        // As with the sine wave, both angles are shifted into +/- Pi.
+        fast_sincos(2*(float)M_PI*wrap_turns(step) - (float)M_PI, &rs[l], &rc[l]);
+        fast_sincos(2*(float)M_PI*data->phases[k+l] - (float)M_PI, &s[l], &c[l]);
+        rs[l] = -rs[l]; rc[l] = -rc[l];
+        s[l] = -s[l]; c[l] = -c[l];
+      }else{
+        rs[l] = sinf(2*(float)M_PI*step); rc[l] = cosf(2*(float)M_PI*step);
+        s[l] = sinf(2*(float)M_PI*data->phases[k+l]); c[l] = cosf(2*(float)M_PI*data->phases[k+l]);
+      }
+    }
+    for(int i=0; i<GENERATOR_CHUNK; ++i){
+      float *restrict lane = lanes+i*GENERATOR_LANES;
+      for(int l=0; l<GENERATOR_LANES; ++l){
+        lane[l] += a[l]*s[l];
+        float cn = c[l]*rc[l] - s[l]*rs[l];
+        s[l] = s[l]*rc[l] + c[l]*rs[l];
+        c[l] = cn;
+      }
+    }
+  }
+
+  for(int i=0; i<GENERATOR_CHUNK; ++i){
+    float sum = 0.0f;
+    for(int l=0; l<GENERATOR_LANES; ++l){
+      sum += lanes[i*GENERATOR_LANES+l];
+    }
+    wave[i] = sum;
+  }
+}
+
+static void advance_partials(struct generator_segment_data *data, float dt, size_t samples){
+  for(size_t k=0; k<data->partials; ++k){
+    // Wrapping the step first keeps the sum small for high partials.
+    float step = wrap_turns(data->ratios[k]*dt*samples);
+    data->phases[k] = wrap_turns(data->phases[k] + step);
+  }
 }
 
 int generator_segment_mix(size_t samples, struct mixed_segment *segment){
   struct generator_segment_data *data = (struct generator_segment_data *)segment->data;
-  size_t phase = data->phase;
-  float (*generator)(float frequency, float phase, float samplerate) = 0;
   float *out = data->out->data;
   float volume = data->volume;
+  float dt = data->frequency / data->samplerate;
+  float phase = data->phase;
+  float phases[GENERATOR_CHUNK];
+  float wave[GENERATOR_CHUNK];
 
-  switch(data->type){
-  case MIXED_SINE: generator = sine_wave; break;
-  case MIXED_SQUARE: generator = square_wave; break;
-  case MIXED_TRIANGLE: generator = triangle_wave; break;
-  case MIXED_SAWTOOTH: generator = sawtooth_wave; break;
-  }
-  
-  for(size_t i=0; i<samples; ++i){
-    out[i] = generator(data->frequency, phase, data->samplerate) * volume;
-    phase = (phase+1) % data->samplerate;
+  for(size_t i=0; i<samples; i+=GENERATOR_CHUNK){
+    size_t chunk = smin(samples-i, GENERATOR_CHUNK);
+    if(data->type == MIXED_ADDITIVE){
+      render_partials(data, dt, wave);
+      advance_partials(data, dt, chunk);
+    }else{
+      for(int t=0; t<GENERATOR_CHUNK; ++t){
+        phases[t] = wrap_turns(phase + dt*t);
+      }
+      render_wave(data->type, data->fast_math, phases, dt, wave);
+    }
+    for(size_t t=0; t<chunk; ++t){
+      out[i+t] = wave[t] * volume;
+    }
+    phase = wrap_turns(phase + wrap_turns(dt*chunk));
   }
 
   data->phase = phase;
   return 1;
 }
 
+// Changes the number of partials, keeping the existing ones.
+static int resize_partials(size_t count, struct generator_segment_data *data){
+  size_t size = (count+GENERATOR_LANES-1)/GENERATOR_LANES*GENERATOR_LANES;
+  size_t old = (data->partials+GENERATOR_LANES-1)/GENERATOR_LANES*GENERATOR_LANES;
+  float *ratios = 0, *amplitudes = 0, *phases = 0;
+  if(0 < size){
+    ratios = calloc(3*size, sizeof(float));
+    if(!ratios){
+      mixed_err(MIXED_OUT_OF_MEMORY);
+      return 0;
+    }
+    amplitudes = ratios+size;
+    phases = amplitudes+size;
+    size_t keep = smin(old, size);
+    if(0 < keep){
+      memcpy(ratios, data->ratios, keep*sizeof(float));
+      memcpy(amplitudes, data->amplitudes, keep*sizeof(float));
+      memcpy(phases, data->phases, keep*sizeof(float));
+    }
+    // New partials default to the next harmonics, and like the padding
+    // they start out silent.
+    for(size_t k=smin(data->partials, count); k<size; ++k){
+      ratios[k] = k+1;
+      amplitudes[k] = 0.0f;
+    }
+  }
+  if(data->ratios)
+    free(data->ratios);
+  data->ratios = ratios;
+  data->amplitudes = amplitudes;
+  data->phases = phases;
+  data->partials = count;
+  return 1;
+}
+
 int generator_segment_info(struct mixed_segment_info *info, struct mixed_segment *segment){
   info->name = "generator";
   info->description = "Wave generator source segment";
   info->min_inputs = 0;
   info->max_inputs = 0;
   info->outputs = 1;
-  
+
   struct mixed_segment_field_info *field = info->fields;
   set_info_field(field++, MIXED_BUFFER,
                  MIXED_BUFFER_POINTER, 1, MIXED_OUT | MIXED_SET,
@@ -91,22 +265,34 @@ int generator_segment_info(struct mixed_segment_info *info, struct mixed_segment
   set_info_field(field++, MIXED_VOLUME,
                  MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
                  "The volume scaling factor.");
-  
+
   set_info_field(field++, MIXED_GENERATOR_FREQUENCY,
                  MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
                  "The frequency in Hz of the generated tone.");
-  
+
   set_info_field(field++, MIXED_GENERATOR_TYPE,
                  MIXED_GENERATOR_TYPE_ENUM, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
                  "The type of wave form that is produced.");
-  
+
+  set_info_field(field++, MIXED_GENERATOR_PARTIALS,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The number of partials of the additive wave.");
+
+  set_info_field(field++, MIXED_GENERATOR_PARTIAL,
+                 MIXED_GENERATOR_PARTIAL_POINTER, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The parameters of the partial selected by the index.");
+
+  set_info_field(field++, MIXED_FAST_MATH,
+                 MIXED_BOOL, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "Whether to approximate the sine waves.");
+
   clear_info_field(field++);
   return 1;
 }
 
 int generator_segment_get(size_t field, void *value, struct mixed_segment *segment){
   struct generator_segment_data *data = (struct generator_segment_data *)segment->data;
-  
+
   switch(field){
   case MIXED_VOLUME:
     *((float *)value) = data->volume;
@@ -117,6 +303,21 @@ int generator_segment_get(size_t field, void *value, struct mixed_segment *segme
   case MIXED_GENERATOR_TYPE:
     *((enum mixed_generator_type *)value) = data->type;
     break;
+  case MIXED_GENERATOR_PARTIALS:
+    *((size_t *)value) = data->partials;
+    break;
+  case MIXED_GENERATOR_PARTIAL: {
+    struct mixed_generator_partial *partial = (struct mixed_generator_partial *)value;
+    if(data->partials <= partial->index){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    partial->ratio = data->ratios[partial->index];
+    partial->amplitude = data->amplitudes[partial->index];
+  } break;
+  case MIXED_FAST_MATH:
+    *((bool *)value) = data->fast_math;
+    break;
   default: mixed_err(MIXED_INVALID_FIELD); return 0;
   }
   return 1;
@@ -139,12 +340,26 @@ int generator_segment_set(size_t field, void *value, struct mixed_segment *segme
     break;
   case MIXED_GENERATOR_TYPE:
     if(*(enum mixed_generator_type *)value < MIXED_SINE ||
-       MIXED_SAWTOOTH < *(enum mixed_generator_type *)value){
+       MIXED_ADDITIVE < *(enum mixed_generator_type *)value){
       mixed_err(MIXED_INVALID_VALUE);
       return 0;
     }
     data->type = *(enum mixed_generator_type *)value;
     break;
+  case MIXED_GENERATOR_PARTIALS:
+    return resize_partials(*(size_t *)value, data);
+  case MIXED_GENERATOR_PARTIAL: {
+    struct mixed_generator_partial *partial = (struct mixed_generator_partial *)value;
+    if(data->partials <= partial->index || partial->ratio < 0.0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->ratios[partial->index] = partial->ratio;
+    data->amplitudes[partial->index] = partial->amplitude;
+  } break;
+  case MIXED_FAST_MATH:
+    data->fast_math = *(bool *)value;
+    break;
   default: mixed_err(MIXED_INVALID_FIELD); return 0;
   }
   return 1;
@@ -161,7 +376,8 @@ MIXED_EXPORT int mixed_make_segment_generator(enum mixed_generator_type type, si
   data->type = type;
   data->samplerate = samplerate;
   data->volume = 1.0f;
-  
+  data->fast_math = 1;
+
   segment->free = generator_segment_free;
   segment->mix = generator_segment_mix;
   segment->set_out = generator_segment_set_out;
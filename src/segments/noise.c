@@ -1,16 +1,37 @@
 #include "internal.h"
-#define WHITE_NOISE_SAMPLES 4096
+
+// Every segment owns the state of its random number generator, so that
+// segments on different threads never share any. The generator is
+// xoshiro128+ by David Blackman and Sebastiano Vigna, run as eight
+// independent streams side by side, which the compiler turns into
+// vector instructions. The streams are seeded once, through splitmix64.
+//
+// Noise is rendered in chunks: the random numbers of a chunk are drawn
+// all at once, and then shaped in a second loop. A block that ends
+// within a chunk leaves the rest of it for the next block, so that the
+// state of the generators always matches the samples handed out.
+
+#define NOISE_CHUNK 64
+#define NOISE_LANES 8
+#define PINK_ROWS 30
 
 struct noise_segment_data{
   struct mixed_buffer *out;
   enum mixed_noise_type type;
   float volume;
-  int64_t pink_rows[30];
-  int64_t pink_running_sum;
+  uint32_t random[4][NOISE_LANES];
+  int32_t pink_rows[PINK_ROWS];
+  int32_t pink_running_sum;
   int32_t pink_index;
   int32_t pink_index_mask;
   float pink_scalar;
   float brown;
+  // The weight of input j for output k across a block of brown noise.
+  float brown_weights[NOISE_LANES][NOISE_LANES];
+  float brown_decay[NOISE_LANES];
+  // The current chunk, and how much of it was handed out already.
+  float wave[NOISE_CHUNK];
+  size_t served;
 };
 
 int noise_segment_free(struct mixed_segment *segment){
@@ -36,57 +57,129 @@ int noise_segment_set_out(size_t field, size_t location, void *buffer, struct mi
   }
 }
 
-float noise_white(struct noise_segment_data *data){
-  return mixed_random()*2.0-1.0;
+static uint64_t splitmix64(uint64_t *x){
+  uint64_t z = (*x += 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
 }
 
-float noise_pink(struct noise_segment_data *data){
-  int64_t random;
-  int64_t sum;
-
-  data->pink_index = (data->pink_index + 1) & data->pink_index_mask;
+static void noise_seed(uint64_t seed, struct noise_segment_data *data){
+  for(int l=0; l<NOISE_LANES; ++l){
+    uint64_t a = splitmix64(&seed);
+    uint64_t b = splitmix64(&seed);
+    data->random[0][l] = (uint32_t)a;
+    data->random[1][l] = (uint32_t)(a >> 32);
+    data->random[2][l] = (uint32_t)b;
+    data->random[3][l] = (uint32_t)(b >> 32);
+  }
+}
 
-  if(data->pink_index != 0) {
-    int zeroes = 0;
-    int n = data->pink_index;
-    while((n & 1) == 0){
-      n = n >> 1;
-      zeroes++;
+// Fills the values with uniformly distributed signed integers.
+static void noise_random(struct noise_segment_data *data, int32_t *restrict values){
+  uint32_t s0[NOISE_LANES], s1[NOISE_LANES], s2[NOISE_LANES], s3[NOISE_LANES];
+  memcpy(s0, data->random[0], sizeof(s0));
+  memcpy(s1, data->random[1], sizeof(s1));
+  memcpy(s2, data->random[2], sizeof(s2));
+  memcpy(s3, data->random[3], sizeof(s3));
+  for(int i=0; i<NOISE_CHUNK; i+=NOISE_LANES){
+    for(int l=0; l<NOISE_LANES; ++l){
+      values[i+l] = (int32_t)(s0[l] + s3[l]);
+      uint32_t t = s1[l] << 9;
+      s2[l] ^= s0[l];
+      s3[l] ^= s1[l];
+      s1[l] ^= s2[l];
+      s0[l] ^= s3[l];
+      s2[l] ^= t;
+      s3[l] = (s3[l] << 11) | (s3[l] >> 21);
     }
+  }
+  memcpy(data->random[0], s0, sizeof(s0));
+  memcpy(data->random[1], s1, sizeof(s1));
+  memcpy(data->random[2], s2, sizeof(s2));
+  memcpy(data->random[3], s3, sizeof(s3));
+}
+
+static void noise_white(struct noise_segment_data *data, float *restrict wave){
+  int32_t random[NOISE_CHUNK];
+  noise_random(data, random);
+  for(int i=0; i<NOISE_CHUNK; ++i){
+    wave[i] = (float)random[i] * (1.0f/2147483648.0f);
+  }
+}
 
-    data->pink_running_sum -= data->pink_rows[zeroes];
-    random = (mixed_random()-0.5)*67108864;
-    data->pink_running_sum += random;
-    data->pink_rows[zeroes] = random;
+// The Voss-McCartney algorithm: row N is replaced every 2^N samples, and
+// the output is the sum of all rows and one more random value.
+static void noise_pink(struct noise_segment_data *data, float *restrict wave){
+  int32_t rows[NOISE_CHUNK], random[NOISE_CHUNK];
+  noise_random(data, rows);
+  noise_random(data, random);
+  int32_t sum = data->pink_running_sum;
+  int32_t index = data->pink_index;
+
+  for(int i=0; i<NOISE_CHUNK; ++i){
+    index = (index + 1) & data->pink_index_mask;
+    if(index != 0){
+      int row = __builtin_ctz(index);
+      int32_t value = rows[i] >> 6;
+      sum += value - data->pink_rows[row];
+      data->pink_rows[row] = value;
+    }
+    wave[i] = data->pink_scalar * (float)(sum + (random[i] >> 6));
   }
-  
-  random = (mixed_random()-0.5)*67108864;
-  sum = data->pink_running_sum + random;
 
-  return data->pink_scalar * sum;
+  data->pink_running_sum = sum;
+  data->pink_index = index;
 }
 
-float noise_brown(struct noise_segment_data *data){
-  data->brown += (mixed_random()*2.0-1.0);
-  data->brown -= data->brown * 0.03125;
-  return data->brown * 0.06250;
+// A leaky integrator of white noise. The recursion is solved for whole
+// blocks at a time, so that only the last value of a block feeds into
+// the next.
+static void noise_brown(struct noise_segment_data *data, float *restrict wave){
+  float white[NOISE_CHUNK];
+  noise_white(data, white);
+  float brown = data->brown;
+
+  for(int i=0; i<NOISE_CHUNK; i+=NOISE_LANES){
+    float block[NOISE_LANES];
+    for(int k=0; k<NOISE_LANES; ++k){
+      block[k] = data->brown_decay[k] * brown;
+    }
+    for(int j=0; j<NOISE_LANES; ++j){
+      for(int k=0; k<NOISE_LANES; ++k){
+        block[k] += data->brown_weights[j][k] * white[i+j];
+      }
+    }
+    brown = block[NOISE_LANES-1];
+    for(int k=0; k<NOISE_LANES; ++k){
+      wave[i+k] = block[k] * 0.06250f;
+    }
+  }
+
+  data->brown = brown;
 }
 
 int noise_segment_mix(size_t samples, struct mixed_segment *segment){
   struct noise_segment_data *data = (struct noise_segment_data *)segment->data;
-
-  float (*noise)(struct noise_segment_data *data) = 0;
   float volume = data->volume;
   float *out = data->out->data;
-  
-  switch(data->type){
-  case MIXED_WHITE_NOISE: noise = noise_white; break;
-  case MIXED_PINK_NOISE: noise = noise_pink; break;
-  case MIXED_BROWN_NOISE: noise = noise_brown; break;
-  }
+  float *wave = data->wave;
 
-  for(size_t i=0; i<samples; ++i){
-    out[i] = noise(data) * volume;
+  for(size_t i=0; i<samples; ){
+    if(data->served == NOISE_CHUNK){
+      switch(data->type){
+      case MIXED_WHITE_NOISE: noise_white(data, wave); break;
+      case MIXED_PINK_NOISE: noise_pink(data, wave); break;
+      case MIXED_BROWN_NOISE: noise_brown(data, wave); break;
+      }
+      data->served = 0;
+    }
+    size_t chunk = smin(samples-i, NOISE_CHUNK-data->served);
+    for(size_t t=0; t<chunk; ++t){
+      out[i+t] = wave[data->served+t] * volume;
+    }
+    data->served += chunk;
+    i += chunk;
   }
   return 1;
 }
@@ -98,7 +191,7 @@ int noise_segment_info(struct mixed_segment_info *info, struct mixed_segment *se
   info->max_inputs = 0;
   info->outputs = 1;
 
-  struct mixed_segment_field_info *field = info->fields;  
+  struct mixed_segment_field_info *field = info->fields;
   set_info_field(field++, MIXED_BUFFER,
                  MIXED_BUFFER_POINTER, 1, MIXED_OUT | MIXED_SET,
                  "The buffer for audio data attached to the location.");
@@ -106,23 +199,23 @@ int noise_segment_info(struct mixed_segment_info *info, struct mixed_segment *se
   set_info_field(field++, MIXED_VOLUME,
                  MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
                  "The volume scaling factor.");
-  
+
   set_info_field(field++, MIXED_NOISE_TYPE,
                  MIXED_NOISE_TYPE_ENUM, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
                  "The type of noise that is produced.");
-  
+
   clear_info_field(field++);
   return 1;
 }
 
 int noise_segment_get(size_t field, void *value, struct mixed_segment *segment){
   struct noise_segment_data *data = (struct noise_segment_data *)segment->data;
-  
+
   switch(field){
   case MIXED_VOLUME:
     *((float *)value) = data->volume;
     break;
-  case MIXED_GENERATOR_TYPE:
+  case MIXED_NOISE_TYPE:
     *((enum mixed_noise_type *)value) = data->type;
     break;
   default: mixed_err(MIXED_INVALID_FIELD); return 0;
@@ -144,6 +237,8 @@ int noise_segment_set(size_t field, void *value, struct mixed_segment *segment){
       return 0;
     }
     data->type = *(enum mixed_noise_type *)value;
+    // The rest of a chunk of the previous type is discarded.
+    data->served = NOISE_CHUNK;
     break;
   default: mixed_err(MIXED_INVALID_FIELD); return 0;
   }
@@ -156,17 +251,32 @@ MIXED_EXPORT int mixed_make_segment_noise(enum mixed_noise_type type, struct mix
     mixed_err(MIXED_OUT_OF_MEMORY);
     return 0;
   }
-  
+
   data->type = type;
   data->volume = 1.0f;
+  data->served = NOISE_CHUNK;
+
+  // Only the seed is drawn from the shared generator.
+  uint64_t seed = (uint64_t)(mixed_random()*16777216.0) << 24;
+  seed ^= (uint64_t)(mixed_random()*16777216.0) ^ (uint64_t)(uintptr_t)data;
+  noise_seed(seed, data);
 
   data->pink_index = 0;
-  data->pink_index_mask = (1<<30) - 1;
-  long pmax = ((30 + 1) * (1<<(23)));
+  data->pink_index_mask = (1<<PINK_ROWS) - 1;
+  long pmax = ((PINK_ROWS + 1) * (1<<(23)));
   data->pink_scalar = 1.0 / (float)pmax;
   data->pink_running_sum = 0;
-  for(size_t i=0; i<30; ++i) data->pink_rows[i] = 0;
-  
+  for(size_t i=0; i<PINK_ROWS; ++i) data->pink_rows[i] = 0;
+
+  // Each sample decays the previous one by 1/32 after adding the noise.
+  float decay = 1.0f - 0.03125f;
+  for(int k=0; k<NOISE_LANES; ++k){
+    data->brown_decay[k] = powf(decay, k+1);
+    for(int j=0; j<NOISE_LANES; ++j){
+      data->brown_weights[j][k] = (j <= k)? powf(decay, k-j+1) : 0.0f;
+    }
+  }
+
   segment->free = noise_segment_free;
   segment->mix = noise_segment_mix;
   segment->set_out = noise_segment_set_out;
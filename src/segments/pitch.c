@@ -4,6 +4,8 @@ struct pitch_segment_data{
   struct mixed_buffer *in;
   struct mixed_buffer *out;
   struct pitch_data pitch_data;
+  struct wsola_data wsola_data;
+  enum mixed_pitch_algorithm algorithm;
   size_t samplerate;
   float pitch;
 };
@@ -11,6 +13,7 @@ struct pitch_segment_data{
 int pitch_segment_free(struct mixed_segment *segment){
   if(segment->data){
     free_pitch_data(&((struct pitch_segment_data *)segment->data)->pitch_data);
+    free_wsola_data(&((struct pitch_segment_data *)segment->data)->wsola_data);
     free(segment->data);
   }
   segment->data = 0;
@@ -63,6 +66,8 @@ int pitch_segment_mix(size_t samples, struct mixed_segment *segment){
 
   if(data->pitch == 1.0){
     mixed_buffer_copy(data->in, data->out);
+  }else if(data->algorithm == MIXED_PITCH_WSOLA){
+    wsola_shift(data->pitch, data->in->data, data->out->data, samples, &data->wsola_data);
   }else{
     pitch_shift(data->pitch, data->in->data, data->out->data, samples, &data->pitch_data);
   }
@@ -97,6 +102,26 @@ int pitch_segment_info(struct mixed_segment_info *info, struct mixed_segment *se
                  MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
                  "The samplerate at which the segment operates.");
 
+  set_info_field(field++, MIXED_PITCH_ALGORITHM,
+                 MIXED_PITCH_ALGORITHM_ENUM, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The algorithm used to shift the pitch.");
+
+  set_info_field(field++, MIXED_PITCH_FRAMESIZE,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The frame size of the phase vocoder.");
+
+  set_info_field(field++, MIXED_PITCH_OVERSAMPLING,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The oversampling factor of the phase vocoder.");
+
+  set_info_field(field++, MIXED_FAST_MATH,
+                 MIXED_BOOL, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "Whether the phase vocoder approximates its trigonometry.");
+
+  set_info_field(field++, MIXED_LATENCY,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_GET,
+                 "The delay introduced by the pitch shifting in samples.");
+
   set_info_field(field++, MIXED_BYPASS,
                  MIXED_BOOL, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
                  "Bypass the segment's processing.");
@@ -110,6 +135,19 @@ int pitch_segment_get(size_t field, void *value, struct mixed_segment *segment){
   switch(field){
   case MIXED_PITCH_SHIFT: *((float *)value) = data->pitch; break;
   case MIXED_SAMPLERATE: *((size_t *)value) = data->samplerate; break;
+  case MIXED_PITCH_ALGORITHM: *((enum mixed_pitch_algorithm *)value) = data->algorithm; break;
+  case MIXED_PITCH_FRAMESIZE: *((size_t *)value) = data->pitch_data.framesize; break;
+  case MIXED_PITCH_OVERSAMPLING: *((size_t *)value) = data->pitch_data.oversampling; break;
+  case MIXED_FAST_MATH: *((bool *)value) = data->pitch_data.fast_math; break;
+  case MIXED_LATENCY:
+    if(data->pitch == 1.0){
+      *((size_t *)value) = 0;
+    }else if(data->algorithm == MIXED_PITCH_WSOLA){
+      *((size_t *)value) = wsola_latency(data->pitch, &data->wsola_data);
+    }else{
+      *((size_t *)value) = pitch_latency(&data->pitch_data);
+    }
+    break;
   case MIXED_BYPASS: *((bool *)value) = (segment->mix == pitch_segment_mix_bypass); break;
   default: mixed_err(MIXED_INVALID_FIELD); return 0;
   }
@@ -124,11 +162,41 @@ int pitch_segment_set(size_t field, void *value, struct mixed_segment *segment){
       mixed_err(MIXED_INVALID_VALUE);
       return 0;
     }
+    if(!reconfigure_pitch_data(data->pitch_data.framesize, data->pitch_data.oversampling, *(size_t *)value, &data->pitch_data)){
+      return 0;
+    }
     data->samplerate = *(size_t *)value;
-    free_pitch_data(&data->pitch_data);
-    if(!make_pitch_data(2048, 4, data->samplerate, &data->pitch_data)){
+    if(data->wsola_data.history){
+      free_wsola_data(&data->wsola_data);
+      if(!make_wsola_data(data->samplerate, &data->wsola_data)){
+        return 0;
+      }
+    }
+    break;
+  case MIXED_PITCH_FRAMESIZE:
+    return reconfigure_pitch_data(*(size_t *)value, data->pitch_data.oversampling, data->samplerate, &data->pitch_data);
+  case MIXED_PITCH_OVERSAMPLING:
+    return reconfigure_pitch_data(data->pitch_data.framesize, *(size_t *)value, data->samplerate, &data->pitch_data);
+  case MIXED_FAST_MATH:
+    pitch_fast_math(*(bool *)value, &data->pitch_data);
+    break;
+  case MIXED_PITCH_ALGORITHM:
+    switch(*(enum mixed_pitch_algorithm *)value){
+    case MIXED_PITCH_VOCODER:
+      break;
+    case MIXED_PITCH_WSOLA:
+      // Only allocate the time-domain state once it is needed.
+      if(!data->wsola_data.history){
+        if(!make_wsola_data(data->samplerate, &data->wsola_data)){
+          return 0;
+        }
+      }
+      break;
+    default:
+      mixed_err(MIXED_INVALID_VALUE);
       return 0;
     }
+    data->algorithm = *(enum mixed_pitch_algorithm *)value;
     break;
   case MIXED_PITCH_SHIFT:
     if(*(float *)value <= 0.0){
@@ -165,6 +233,7 @@ MIXED_EXPORT int mixed_make_segment_pitch(float pitch, size_t samplerate, struct
 
   data->pitch = pitch;
   data->samplerate = samplerate;
+  data->algorithm = MIXED_PITCH_VOCODER;
   
   segment->free = pitch_segment_free;
   segment->start = pitch_segment_start;
@@ -3,8 +3,7 @@
 struct repeat_segment_data{
   struct mixed_buffer *in;
   struct mixed_buffer *out;
-  struct mixed_buffer buffer;
-  size_t buffer_index;
+  struct ring_data ring;
   float time;
   size_t samplerate;
   enum mixed_repeat_mode mode;
@@ -12,7 +11,7 @@ struct repeat_segment_data{
 
 int repeat_segment_free(struct mixed_segment *segment){
   if(segment->data){
-    mixed_free_buffer(&((struct repeat_segment_data *)segment->data)->buffer);
+    free_ring_data(&((struct repeat_segment_data *)segment->data)->ring);
     free(segment->data);
   }
   segment->data = 0;
@@ -23,8 +22,7 @@ int repeat_segment_free(struct mixed_segment *segment){
 
 int repeat_segment_start(struct mixed_segment *segment){
   struct repeat_segment_data *data = (struct repeat_segment_data *)segment->data;
-  data->buffer_index = 0.0;
-  mixed_buffer_clear(&data->buffer);
+  ring_clear(&data->ring);
   return 1;
 }
 
@@ -65,36 +63,17 @@ int repeat_segment_set_out(size_t field, size_t location, void *buffer, struct m
 int repeat_segment_mix_record(size_t samples, struct mixed_segment *segment){
   struct repeat_segment_data *data = (struct repeat_segment_data *)segment->data;
 
-  size_t repeat_samples = data->buffer.size;
-  size_t index = data->buffer_index;
-
-  float *buf = data->buffer.data;
-  float *in = data->in->data;
-  float *out = data->out->data;
-  for(size_t i=0; i<samples; ++i){
-    buf[index] = in[i];
-    out[i] = buf[index];
-    index = (index+1)%repeat_samples;
+  ring_write(data->in->data, samples, &data->ring);
+  if(data->in != data->out){
+    memcpy(data->out->data, data->in->data, samples*sizeof(float));
   }
-
-  data->buffer_index = index;
   return 1;
 }
 
 int repeat_segment_mix_play(size_t samples, struct mixed_segment *segment){
   struct repeat_segment_data *data = (struct repeat_segment_data *)segment->data;
 
-  size_t repeat_samples = data->buffer.size;
-  size_t index = data->buffer_index;
-
-  float *buf = data->buffer.data;
-  float *out = data->out->data;
-  for(size_t i=0; i<samples; ++i){
-    out[i] = buf[index];
-    index = (index+1)%repeat_samples;
-  }
-
-  data->buffer_index = index;
+  ring_read(data->out->data, samples, &data->ring);
   return 1;
 }
 
@@ -155,16 +134,20 @@ int repeat_segment_set(size_t field, void *value, struct mixed_segment *segment)
       mixed_err(MIXED_INVALID_VALUE);
       return 0;
     }
+    if(!ring_resize(ceil(*(size_t *)value * data->time), &data->ring)){
+      return 0;
+    }
     data->samplerate = *(size_t *)value;
-    mixed_buffer_resize(ceil(data->samplerate * data->time), &data->buffer);
     break;
-  case MIXED_DELAY_TIME:
+  case MIXED_REPEAT_TIME:
     if(*(float *)value < 0.0){
       mixed_err(MIXED_INVALID_VALUE);
       return 0;
     }
+    if(!ring_resize(ceil(data->samplerate * *(float *)value), &data->ring)){
+      return 0;
+    }
     data->time = *(float *)value;
-    mixed_buffer_resize(ceil(data->samplerate * data->time), &data->buffer);
     break;
   case MIXED_REPEAT_MODE:
     if(*(enum mixed_repeat_mode *)value < MIXED_RECORD ||
@@ -177,6 +160,7 @@ int repeat_segment_set(size_t field, void *value, struct mixed_segment *segment)
     case MIXED_RECORD: segment->mix = repeat_segment_mix_record; break;
     case MIXED_PLAY: segment->mix = repeat_segment_mix_play; break;
     }
+    break;
   case MIXED_BYPASS:
     if(*(bool *)value){
       segment->mix = repeat_segment_mix_bypass;
@@ -201,7 +185,7 @@ MIXED_EXPORT int mixed_make_segment_repeat(float time, size_t samplerate, struct
     return 0;
   }
 
-  if(!mixed_make_buffer(ceil(time * samplerate), &data->buffer)){
+  if(!make_ring_data(ceil(time * samplerate), &data->ring)){
     free(data);
     return 0;
   }
@@ -0,0 +1,393 @@
+#include "internal.h"
+
+// A feedback delay network reverb.
+//
+// Every line is a ring buffer like the delay segment's. The oldest
+// samples of all lines are damped by a one-pole lowpass, attenuated
+// according to the decay time, mixed by a Hadamard matrix, and fed back
+// into the lines together with the input. As the shortest line is
+// longer than a chunk, the feedback of a whole chunk can be computed at
+// once, which turns the matrix and most other steps into loops over
+// contiguous samples that the compiler vectorizes.
+//
+// A decaying tail ends up in denormals, which are very slow on most
+// machines, so the damping state and the fed back samples are flushed
+// to zero once they fall below 1e-30.
+
+#define REVERB_MAX_LINES 16
+#define REVERB_CHUNK 64
+
+// Mutually distinct line lengths in milliseconds at size 1.
+static const float reverb_lengths[REVERB_MAX_LINES] = {
+  13.1, 14.9, 16.7, 18.3, 20.3, 22.1, 24.7, 27.3,
+  29.9, 33.1, 36.7, 40.3, 44.3, 49.1, 53.9, 59.3
+};
+
+struct reverb_segment_data{
+  struct mixed_buffer *in;
+  struct mixed_buffer *out;
+  float *buffer;
+  float *line[REVERB_MAX_LINES];
+  size_t length[REVERB_MAX_LINES];
+  size_t position[REVERB_MAX_LINES];
+  float gain[REVERB_MAX_LINES];
+  float state[REVERB_MAX_LINES];
+  float block[REVERB_MAX_LINES][REVERB_CHUNK];
+  float wet[REVERB_CHUNK];
+  size_t lines;
+  size_t chunk;
+  size_t samplerate;
+  float time;
+  float size;
+  float damping;
+  float mix;
+};
+
+static inline float flush_denormal(float x){
+  return (fabsf(x) < 1e-30f)? 0.0f : x;
+}
+
+static bool is_prime(size_t n){
+  if(n < 2) return 0;
+  for(size_t d=2; d*d<=n; ++d){
+    if(n % d == 0) return 0;
+  }
+  return 1;
+}
+
+static void update_reverb_gains(struct reverb_segment_data *data){
+  // The matrix is applied unnormalised, so its scale is folded in here.
+  float scale = 1.0/sqrt(data->lines);
+  for(size_t l=0; l<data->lines; ++l){
+    data->gain[l] = scale*pow(10.0, -3.0*data->length[l]/(data->time*data->samplerate));
+  }
+}
+
+// (Re)allocate the lines for the current line count, size, and samplerate.
+// If this fails, the previous lines are kept.
+static int resize_reverb_lines(size_t lines, float size, size_t samplerate, struct reverb_segment_data *data){
+  size_t length[REVERB_MAX_LINES];
+  size_t total = 0;
+  // Spread the lines over the whole range of lengths.
+  size_t stride = REVERB_MAX_LINES/lines;
+  for(size_t l=0; l<lines; ++l){
+    size_t n = reverb_lengths[l*stride+stride/2]*size*samplerate/1000.0;
+    // Prime lengths keep the echoes of the lines from coinciding.
+    while(!is_prime(n)) ++n;
+    length[l] = n;
+    total += n;
+  }
+
+  float *buffer = calloc(total, sizeof(float));
+  if(!buffer){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    return 0;
+  }
+  if(data->buffer)
+    free(data->buffer);
+  data->buffer = buffer;
+
+  data->chunk = REVERB_CHUNK;
+  for(size_t l=0; l<lines; ++l){
+    data->line[l] = buffer;
+    data->length[l] = length[l];
+    data->position[l] = 0;
+    data->state[l] = 0.0;
+    data->chunk = smin(data->chunk, length[l]);
+    buffer += length[l];
+  }
+  data->lines = lines;
+  data->size = size;
+  data->samplerate = samplerate;
+  update_reverb_gains(data);
+  return 1;
+}
+
+int reverb_segment_free(struct mixed_segment *segment){
+  struct reverb_segment_data *data = (struct reverb_segment_data *)segment->data;
+  if(data){
+    if(data->buffer)
+      free(data->buffer);
+    free(data);
+  }
+  segment->data = 0;
+  return 1;
+}
+
+int reverb_segment_start(struct mixed_segment *segment){
+  struct reverb_segment_data *data = (struct reverb_segment_data *)segment->data;
+  for(size_t l=0; l<data->lines; ++l){
+    memset(data->line[l], 0, data->length[l]*sizeof(float));
+    data->position[l] = 0;
+    data->state[l] = 0.0;
+  }
+  return 1;
+}
+
+int reverb_segment_set_in(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
+  struct reverb_segment_data *data = (struct reverb_segment_data *)segment->data;
+
+  switch(field){
+  case MIXED_BUFFER:
+    if(location == 0){
+      data->in = (struct mixed_buffer *)buffer;
+      return 1;
+    }
+    mixed_err(MIXED_INVALID_LOCATION);
+    return 0;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+}
+
+int reverb_segment_set_out(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
+  struct reverb_segment_data *data = (struct reverb_segment_data *)segment->data;
+
+  switch(field){
+  case MIXED_BUFFER:
+    if(location == 0){
+      data->out = (struct mixed_buffer *)buffer;
+      return 1;
+    }
+    mixed_err(MIXED_INVALID_LOCATION);
+    return 0;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+}
+
+int reverb_segment_mix(size_t samples, struct mixed_segment *segment){
+  struct reverb_segment_data *data = (struct reverb_segment_data *)segment->data;
+  size_t lines = data->lines;
+  float damping = data->damping;
+  float dry = 1.0 - data->mix;
+  // The input is spread over all lines, and the output gathered from
+  // them, keeping the level independent of the number of lines.
+  float input_gain = 1.0/sqrt(lines);
+  float wet_gain = data->mix*sqrt(lines);
+  float *in = data->in->data;
+  float *out = data->out->data;
+  float *wet = data->wet;
+
+  for(size_t i=0; i<samples; ){
+    size_t chunk = smin(samples-i, data->chunk);
+
+    // Read the oldest samples of every line.
+    for(size_t l=0; l<lines; ++l){
+      size_t position = data->position[l];
+      size_t first = smin(chunk, data->length[l]-position);
+      memcpy(data->block[l], data->line[l]+position, first*sizeof(float));
+      memcpy(data->block[l]+first, data->line[l], (chunk-first)*sizeof(float));
+    }
+
+    // Damp and attenuate every line.
+    for(size_t t=0; t<chunk; ++t){
+      for(size_t l=0; l<lines; ++l){
+        float x = data->block[l][t];
+        data->state[l] = x + damping*(data->state[l] - x);
+        data->block[l][t] = data->state[l] * data->gain[l];
+      }
+    }
+    for(size_t l=0; l<lines; ++l){
+      data->state[l] = flush_denormal(data->state[l]);
+    }
+
+    // Tap the output with alternating signs to decorrelate the lines.
+    memset(wet, 0, chunk*sizeof(float));
+    for(size_t l=0; l<lines; ++l){
+      float sign = (l & 1)? -1.0 : 1.0;
+      float *block = data->block[l];
+      for(size_t t=0; t<chunk; ++t){
+        wet[t] += sign*block[t];
+      }
+    }
+
+    // Mix the lines with a fast Walsh-Hadamard transform.
+    for(size_t h=1; h<lines; h*=2){
+      for(size_t b=0; b<lines; b+=2*h){
+        for(size_t l=b; l<b+h; ++l){
+          float *x = data->block[l];
+          float *y = data->block[l+h];
+          for(size_t t=0; t<chunk; ++t){
+            float a = x[t], c = y[t];
+            x[t] = a + c;
+            y[t] = a - c;
+          }
+        }
+      }
+    }
+
+    // Feed the input back in and write the lines.
+    for(size_t l=0; l<lines; ++l){
+      float *block = data->block[l];
+      for(size_t t=0; t<chunk; ++t){
+        block[t] = flush_denormal(block[t]) + input_gain*in[i+t];
+      }
+      size_t position = data->position[l];
+      size_t first = smin(chunk, data->length[l]-position);
+      memcpy(data->line[l]+position, block, first*sizeof(float));
+      memcpy(data->line[l], block+first, (chunk-first)*sizeof(float));
+      position += chunk;
+      data->position[l] = (position < data->length[l])? position : position-data->length[l];
+    }
+
+    for(size_t t=0; t<chunk; ++t){
+      out[i+t] = dry*in[i+t] + wet_gain*wet[t];
+    }
+    i += chunk;
+  }
+  return 1;
+}
+
+int reverb_segment_mix_bypass(size_t samples, struct mixed_segment *segment){
+  struct reverb_segment_data *data = (struct reverb_segment_data *)segment->data;
+
+  return mixed_buffer_copy(data->in, data->out);
+}
+
+int reverb_segment_info(struct mixed_segment_info *info, struct mixed_segment *segment){
+  struct reverb_segment_data *data = (struct reverb_segment_data *)segment->data;
+  info->name = "reverb";
+  info->description = "Add reverberation through a feedback delay network.";
+  info->flags = MIXED_INPLACE;
+  info->min_inputs = 1;
+  info->max_inputs = 1;
+  info->outputs = 1;
+
+  struct mixed_segment_field_info *field = info->fields;
+  set_info_field(field++, MIXED_BUFFER,
+                 MIXED_BUFFER_POINTER, 1, MIXED_IN | MIXED_OUT | MIXED_SET,
+                 "The buffer for audio data attached to the location.");
+
+  set_info_field(field++, MIXED_REVERB_LINES,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The number of delay lines, either 8 or 16.");
+
+  set_info_field(field++, MIXED_REVERB_TIME,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The time, in seconds, it takes the reverb to decay by 60dB.");
+
+  set_info_field(field++, MIXED_REVERB_SIZE,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The factor by which the delay lines are lengthened.");
+
+  set_info_field(field++, MIXED_REVERB_DAMPING,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "How much faster high frequencies decay, in [0, 1[.");
+
+  set_info_field(field++, MIXED_REVERB_MIX,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The share of the reverberated signal in the output, in [0, 1].");
+
+  set_info_field(field++, MIXED_SAMPLERATE,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The samplerate at which the segment operates.");
+
+  set_info_field(field++, MIXED_BYPASS,
+                 MIXED_BOOL, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "Bypass the segment's processing.");
+
+  clear_info_field(field++);
+  return 1;
+}
+
+int reverb_segment_get(size_t field, void *value, struct mixed_segment *segment){
+  struct reverb_segment_data *data = (struct reverb_segment_data *)segment->data;
+  switch(field){
+  case MIXED_REVERB_LINES: *((size_t *)value) = data->lines; break;
+  case MIXED_REVERB_TIME: *((float *)value) = data->time; break;
+  case MIXED_REVERB_SIZE: *((float *)value) = data->size; break;
+  case MIXED_REVERB_DAMPING: *((float *)value) = data->damping; break;
+  case MIXED_REVERB_MIX: *((float *)value) = data->mix; break;
+  case MIXED_SAMPLERATE: *((size_t *)value) = data->samplerate; break;
+  case MIXED_BYPASS: *((bool *)value) = (segment->mix == reverb_segment_mix_bypass); break;
+  default: mixed_err(MIXED_INVALID_FIELD); return 0;
+  }
+  return 1;
+}
+
+int reverb_segment_set(size_t field, void *value, struct mixed_segment *segment){
+  struct reverb_segment_data *data = (struct reverb_segment_data *)segment->data;
+  switch(field){
+  case MIXED_REVERB_LINES:
+    if(*(size_t *)value != 8 && *(size_t *)value != 16){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    return resize_reverb_lines(*(size_t *)value, data->size, data->samplerate, data);
+  case MIXED_REVERB_TIME:
+    if(*(float *)value <= 0.0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->time = *(float *)value;
+    update_reverb_gains(data);
+    break;
+  case MIXED_REVERB_SIZE:
+    if(*(float *)value < 0.1 || 10.0 < *(float *)value){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    return resize_reverb_lines(data->lines, *(float *)value, data->samplerate, data);
+  case MIXED_REVERB_DAMPING:
+    if(*(float *)value < 0.0 || 1.0 <= *(float *)value){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->damping = *(float *)value;
+    break;
+  case MIXED_REVERB_MIX:
+    if(*(float *)value < 0.0 || 1.0 < *(float *)value){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->mix = *(float *)value;
+    break;
+  case MIXED_SAMPLERATE:
+    if(*(size_t *)value <= 0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    return resize_reverb_lines(data->lines, data->size, *(size_t *)value, data);
+  case MIXED_BYPASS:
+    if(*(bool *)value){
+      segment->mix = reverb_segment_mix_bypass;
+    }else{
+      segment->mix = reverb_segment_mix;
+    }
+    break;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+  return 1;
+}
+
+MIXED_EXPORT int mixed_make_segment_reverb(size_t samplerate, struct mixed_segment *segment){
+  struct reverb_segment_data *data = calloc(1, sizeof(struct reverb_segment_data));
+  if(!data){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    return 0;
+  }
+
+  data->time = 1.5;
+  data->damping = 0.3;
+  data->mix = 0.3;
+  if(!resize_reverb_lines(8, 1.0, samplerate, data)){
+    free(data);
+    return 0;
+  }
+
+  segment->free = reverb_segment_free;
+  segment->start = reverb_segment_start;
+  segment->mix = reverb_segment_mix;
+  segment->set_in = reverb_segment_set_in;
+  segment->set_out = reverb_segment_set_out;
+  segment->info = reverb_segment_info;
+  segment->get = reverb_segment_get;
+  segment->set = reverb_segment_set;
+  segment->data = data;
+  return 1;
+}
@@ -1,16 +1,46 @@
 #include "internal.h"
+// Sources quieter than this (-80dB) are considered inaudible.
+#define AUDIBLE_THRESHOLD 0.0001
+// Must be a power of two.
+#define GRID_BUCKETS 4096
+#define ATTENUATION_TABLE_SIZE 256
+#define MAX_LISTENERS 8
+#define MAX_AMBISONIC_ORDER 3
+#define MAX_AMBISONIC_CHANNELS 16
+#define AMBISONIC_SPEAKERS 8
 
 struct space_source{
   struct mixed_segment *segment;
   struct mixed_buffer *buffer;
   float location[3];
   float velocity[3];
+  float priority;
+  float score;
+  bool real;
+  // Per listener state
+  float distance[MAX_LISTENERS];
+  float volume[MAX_LISTENERS];
+  float gain[MAX_LISTENERS][2];
+  float heading[MAX_LISTENERS][3];
+  // Spatial grid bucket chain
+  struct space_source *next;
+  struct space_source **prev;
+  long cell[3];
+  size_t stamp;
 };
 
-struct space_mixer_data{
-  struct space_source **sources;
-  size_t count;
-  size_t size;
+// The attenuation curve sampled over [min, max]. The samples are
+// spaced logarithmically, as most curves fall off quickly close to
+// the minimal distance.
+struct attenuation_table{
+  float table[ATTENUATION_TABLE_SIZE+1];
+  float min;
+  float max;
+  float offset;
+  float scale;
+};
+
+struct space_listener{
   struct mixed_buffer *left;
   struct mixed_buffer *right;
   struct pitch_data pitch_data;
@@ -18,6 +48,23 @@ struct space_mixer_data{
   float velocity[3];
   float direction[3];
   float up[3];
+  float *bus;
+  // The decoding gains of the bus channels of the last mix.
+  float decode[2][MAX_AMBISONIC_CHANNELS];
+};
+
+struct space_mixer_data{
+  struct space_source **sources;
+  size_t count;
+  size_t size;
+  struct space_listener listeners[MAX_LISTENERS];
+  size_t listener_count;
+  float *shifted;
+  size_t shifted_size;
+  size_t samplerate;
+  size_t pitch_framesize;
+  size_t pitch_oversampling;
+  bool fast_math;
   float soundspeed;
   float doppler_factor;
   float min_distance;
@@ -25,13 +72,146 @@ struct space_mixer_data{
   float rolloff;
   float volume;
   float (*attenuation)(float min, float max, float dist, float roll);
+  struct attenuation_table attenuation_table;
+  float *distances;
+  float *volumes;
+  struct space_source **voices;
+  struct space_source **considered;
+  struct space_source **active;
+  size_t active_count;
+  size_t scratch_size;
+  size_t max_voices;
+  size_t real_voices;
+  size_t virtual_voices;
+  struct space_source **grid;
+  float grid_size;
+  size_t stamp;
+  size_t ambisonic_order;
+  float ambisonic_weights[MAX_AMBISONIC_ORDER+1];
 };
 
+static inline size_t grid_hash(long cell[3]){
+  return ((size_t)cell[0]*73856093 ^ (size_t)cell[1]*19349663 ^ (size_t)cell[2]*83492791) & (GRID_BUCKETS-1);
+}
+
+static inline void grid_cell(float location[3], float size, long cell[3]){
+  cell[0] = floor(location[0] / size);
+  cell[1] = floor(location[1] / size);
+  cell[2] = floor(location[2] / size);
+}
+
+static void grid_remove(struct space_source *source){
+  if(source->prev){
+    *source->prev = source->next;
+    if(source->next) source->next->prev = source->prev;
+  }
+  source->next = 0;
+  source->prev = 0;
+}
+
+static void grid_insert(struct space_source *source, struct space_mixer_data *data){
+  grid_cell(source->location, data->grid_size, source->cell);
+  struct space_source **bucket = &data->grid[grid_hash(source->cell)];
+  source->next = *bucket;
+  source->prev = bucket;
+  if(*bucket) (*bucket)->prev = &source->next;
+  *bucket = source;
+}
+
+static void grid_update(struct space_source *source, struct space_mixer_data *data){
+  long cell[3];
+  grid_cell(source->location, data->grid_size, cell);
+  if(cell[0] != source->cell[0] || cell[1] != source->cell[1] || cell[2] != source->cell[2]){
+    grid_remove(source);
+    grid_insert(source, data);
+  }
+}
+
+static int grid_resize(float size, struct space_mixer_data *data){
+  if(0.0 < size){
+    if(!data->grid){
+      data->grid = calloc(GRID_BUCKETS, sizeof(struct space_source *));
+      if(!data->grid){
+        mixed_err(MIXED_OUT_OF_MEMORY);
+        return 0;
+      }
+    }
+    memset(data->grid, 0, GRID_BUCKETS*sizeof(struct space_source *));
+  }
+  for(size_t i=0; i<data->count; ++i){
+    data->sources[i]->next = 0;
+    data->sources[i]->prev = 0;
+  }
+  data->grid_size = size;
+  if(0.0 < size){
+    for(size_t i=0; i<data->count; ++i){
+      grid_insert(data->sources[i], data);
+    }
+  }else if(data->grid){
+    free(data->grid);
+    data->grid = 0;
+  }
+  return 1;
+}
+
+static int ensure_scratch(struct space_mixer_data *data){
+  size_t size = data->size;
+  if(data->scratch_size < size){
+    struct space_source **voices = crealloc(data->voices, data->scratch_size, size, sizeof(struct space_source *));
+    if(voices) data->voices = voices;
+    struct space_source **considered = crealloc(data->considered, data->scratch_size, size, sizeof(struct space_source *));
+    if(considered) data->considered = considered;
+    struct space_source **active = crealloc(data->active, data->scratch_size, size, sizeof(struct space_source *));
+    if(active) data->active = active;
+    float *distances = crealloc(data->distances, data->scratch_size, size, sizeof(float));
+    if(distances) data->distances = distances;
+    float *volumes = crealloc(data->volumes, data->scratch_size, size, sizeof(float));
+    if(volumes) data->volumes = volumes;
+    if(!voices || !considered || !active || !distances || !volumes){
+      mixed_err(MIXED_OUT_OF_MEMORY);
+      return 0;
+    }
+    data->scratch_size = size;
+  }
+  return 1;
+}
+
+static int make_listener(struct space_mixer_data *data, struct space_listener *listener){
+  memset(listener, 0, sizeof(struct space_listener));
+  if(!make_pitch_data(data->pitch_framesize, data->pitch_oversampling, data->samplerate, &listener->pitch_data)){
+    return 0;
+  }
+  pitch_fast_math(data->fast_math, &listener->pitch_data);
+  listener->direction[2] = 1.0;  // Facing in Z+ direction
+  listener->up[1] = 1.0;         // OpenGL-like. Y+ is up.
+  return 1;
+}
+
+static void free_listener(struct space_listener *listener){
+  free_pitch_data(&listener->pitch_data);
+  free(listener->bus);
+  listener->bus = 0;
+  listener->left = 0;
+  listener->right = 0;
+}
+
 int space_mixer_free(struct mixed_segment *segment){
   struct space_mixer_data *data = (struct space_mixer_data *)segment->data;
   if(data){
-    free_pitch_data(&data->pitch_data);
+    for(size_t i=0; i<data->listener_count; ++i){
+      free_listener(&data->listeners[i]);
+    }
+    free(data->shifted);
+    for(size_t i=0; i<data->count; ++i){
+      free(data->sources[i]);
+    }
     free(data->sources);
+    free(data->voices);
+    free(data->considered);
+    free(data->active);
+    free(data->distances);
+    free(data->volumes);
+    free(data->grid);
     free(data);
   }
   segment->data = 0;
@@ -78,6 +258,61 @@ float attenuation_exponential(float min, float max, float dist, float roll){
   return 1.0/pow(dist / min, roll);
 }
 
+// Piecewise linear approximation of log2 and its exact inverse.
+static inline float approx_log2(float x){
+  union { float f; uint32_t i; } v = {x};
+  return (float)v.i / (1<<23) - 127.0;
+}
+
+static inline float approx_exp2(float x){
+  union { float f; uint32_t i; } v;
+  v.i = (uint32_t)((x + 127.0) * (1<<23));
+  return v.f;
+}
+
+// Sample the attenuation function into the table. This must be
+// called whenever any of the parameters of the curve change.
+void update_attenuation_table(struct space_mixer_data *data){
+  struct attenuation_table *table = &data->attenuation_table;
+  float min = data->min_distance;
+  float max = data->max_distance;
+  float roll = data->rolloff;
+  table->min = min;
+  table->max = max;
+  table->offset = approx_log2(min);
+  table->scale = (min < max)
+    ? ATTENUATION_TABLE_SIZE / (approx_log2(max) - table->offset)
+    : 0.0;
+  for(size_t i=0; i<=ATTENUATION_TABLE_SIZE; ++i){
+    float distance = (table->scale == 0.0)
+      ? min
+      : approx_exp2(table->offset + i / table->scale);
+    if(distance < min) distance = min;
+    if(max < distance) distance = max;
+    table->table[i] = data->attenuation(min, max, distance, roll);
+  }
+}
+
+// Compute the attenuation for a batch of distances. Distances beyond
+// the maximum result in zero.
+void attenuation_lookup(struct attenuation_table *table, float *distances, float *volumes, size_t count){
+  float min = table->min;
+  float max = table->max;
+  float offset = table->offset;
+  float scale = table->scale;
+  float *curve = table->table;
+  for(size_t i=0; i<count; ++i){
+    float distance = distances[i];
+    float clamped = (distance < min)? min : ((distance < max)? distance : max);
+    float x = (approx_log2(clamped) - offset) * scale;
+    size_t index = (size_t)x;
+    if(ATTENUATION_TABLE_SIZE <= index) index = ATTENUATION_TABLE_SIZE-1;
+    float t = x - index;
+    float volume = curve[index] + t * (curve[index+1] - curve[index]);
+    volumes[i] = (max < distance)? 0.0 : volume;
+  }
+}
+
 static inline float dot(float a[3], float b[3]){
   return a[0]*b[0]+a[1]*b[1]+a[2]*b[2];
 }
@@ -124,33 +359,27 @@ static inline float calculate_phase(float S[3], float L[3], float D[3]){
   return dot(norm(D), norm(t2));
 }
 
-static inline void calculate_volumes(float *lvolume, float *rvolume, struct space_source *source, struct space_mixer_data *data){
-  float min = data->min_distance;
-  float max = data->max_distance;
-  float roll = data->rolloff;
-  float div = data->volume;
-  float distance = clamp(min, dist(source->location, data->location), max);
-  float volume = div * data->attenuation(min, max, distance, roll);
-  float pan = (distance <= min)
+static inline void calculate_volumes(float *lvolume, float *rvolume, float volume, float distance, struct space_source *source, struct space_listener *listener, struct space_mixer_data *data){
+  float pan = (distance <= data->min_distance)
     ? 0.0
-    : calculate_pan(source->location, data->location, data->direction, data->up);
+    : calculate_pan(source->location, listener->location, listener->direction, listener->up);
   *lvolume = volume * ((0.0<pan)?(1.0f-pan):1.0f);
   *rvolume = volume * ((pan<0.0)?(1.0f+pan):1.0f);
-  if(calculate_phase(source->location, data->location, data->direction) < 0){
+  if(calculate_phase(source->location, listener->location, listener->direction) < 0){
     *rvolume *= -1.0;
   }
 }
 
-float calculate_pitch_shift(struct space_mixer_data *listener, struct space_source *source){
-  if(listener->doppler_factor <= 0.0) return 1.0;
+float calculate_pitch_shift(struct space_mixer_data *data, struct space_listener *listener, struct space_source *source){
+  if(data->doppler_factor <= 0.0) return 1.0;
   // See OpenAL1.1 specification §3.5.2
   float SL[3] = {listener->location[0] - source->location[0],
                  listener->location[1] - source->location[1],
                  listener->location[2] - source->location[2]};
   float *SV = source->velocity;
   float *LV = listener->velocity;
-  float SS = listener->soundspeed;
-  float DF = listener->doppler_factor;
+  float SS = data->soundspeed;
+  float DF = data->doppler_factor;
   float Mag = mag(SL);
   float vls = dot(SL, LV) * Mag;
   float vss = dot(SL, SV) * Mag;
@@ -160,78 +389,506 @@ float calculate_pitch_shift(struct space_mixer_data *listener, struct space_sour
   return (SS - DF*vls) / (SS - DF*vss);
 }
 
+static inline size_t ambisonic_channels(size_t order){
+  return (order+1)*(order+1);
+}
+
+// Real spherical harmonics up to the given order in ACN channel order
+// with SN3D normalisation, evaluated for the unit vector D. The bus
+// is kept in world space, so the axes need no particular meaning.
+static void ambisonic_harmonics(float D[3], size_t order, float *Y){
+  float x = D[0], y = D[1], z = D[2];
+  Y[0] = 1.0;
+  if(order < 1) return;
+  Y[1] = y;
+  Y[2] = z;
+  Y[3] = x;
+  if(order < 2) return;
+  Y[4] = 1.7320508f * x * y;
+  Y[5] = 1.7320508f * y * z;
+  Y[6] = 0.5f * (3.0f * z * z - 1.0f);
+  Y[7] = 1.7320508f * x * z;
+  Y[8] = 0.8660254f * (x * x - y * y);
+  if(order < 3) return;
+  Y[9] = 0.7905694f * y * (3.0f * x * x - y * y);
+  Y[10] = 3.8729833f * x * y * z;
+  Y[11] = 0.6123724f * y * (5.0f * z * z - 1.0f);
+  Y[12] = 0.5f * z * (5.0f * z * z - 3.0f);
+  Y[13] = 0.6123724f * x * (5.0f * z * z - 1.0f);
+  Y[14] = 1.9364917f * z * (x * x - y * y);
+  Y[15] = 0.7905694f * x * (x * x - 3.0f * y * y);
+}
+
+// Compute the max-rE weights of each order for the virtual
+// speakers, normalised to unit gain along their axis.
+static void update_ambisonic_weights(struct space_mixer_data *data){
+  size_t order = data->ambisonic_order;
+  float *weights = data->ambisonic_weights;
+  float x = cos(2.4068f / (order + 1.51f));
+  float P[MAX_AMBISONIC_ORDER+1] = {1.0, x};
+  float total = 0.0;
+  for(size_t n=2; n<=order; ++n){
+    P[n] = ((2*n-1) * x * P[n-1] - (n-1) * P[n-2]) / n;
+  }
+  for(size_t n=0; n<=order; ++n){
+    weights[n] = (2*n+1) * P[n];
+    total += weights[n];
+  }
+  for(size_t n=0; n<=order; ++n){
+    weights[n] /= total;
+  }
+}
+
+// (Re)allocate the ambisonic buses of all listeners. If this fails
+// all buses are dropped and the sources are panned directly again.
+static int resize_buses(size_t order, struct space_mixer_data *data){
+  float *buses[MAX_LISTENERS] = {0};
+  int result = 1;
+  // Without any output buffers there is nothing to allocate yet.
+  if(0 < order && 0 < data->shifted_size){
+    for(size_t l=0; l<data->listener_count; ++l){
+      buses[l] = calloc(ambisonic_channels(order)*data->shifted_size, sizeof(float));
+      if(!buses[l]){
+        for(size_t i=0; i<l; ++i) free(buses[i]);
+        memset(buses, 0, sizeof(buses));
+        mixed_err(MIXED_OUT_OF_MEMORY);
+        order = 0;
+        result = 0;
+        break;
+      }
+    }
+  }
+  for(size_t l=0; l<data->listener_count; ++l){
+    struct space_listener *listener = &data->listeners[l];
+    // Channels that were not decoded before fade in from silence.
+    size_t decoded = (listener->bus)? ambisonic_channels(data->ambisonic_order) : 0;
+    for(size_t c=decoded; c<MAX_AMBISONIC_CHANNELS; ++c){
+      listener->decode[0][c] = 0.0;
+      listener->decode[1][c] = 0.0;
+    }
+    free(listener->bus);
+    listener->bus = buses[l];
+  }
+  data->ambisonic_order = order;
+  update_ambisonic_weights(data);
+  return result;
+}
+
+// Encode the source into the listener's bus, ramping from the last
+// encoding gains to avoid clicks.
+static void ambisonic_encode(float *in, size_t samples, float volume, struct space_source *source, size_t l, struct space_listener *listener, struct space_mixer_data *data){
+  size_t order = data->ambisonic_order;
+  size_t channels = ambisonic_channels(order);
+  float *heading = source->heading[l];
+  float from[MAX_AMBISONIC_CHANNELS], to[MAX_AMBISONIC_CHANNELS];
+  float D[3] = {source->location[0] - listener->location[0],
+                source->location[1] - listener->location[1],
+                source->location[2] - listener->location[2]};
+  // Within the minimal distance the source has no direction.
+  if(source->distance[l] <= data->min_distance){
+    D[0] = 0.0; D[1] = 0.0; D[2] = 0.0;
+  }
+  norm(D);
+  ambisonic_harmonics(heading, order, from);
+  ambisonic_harmonics(D, order, to);
+  float last = source->gain[l][0];
+  for(size_t c=0; c<channels; ++c){
+    float *bus = listener->bus + c*samples;
+    float start = from[c] * last;
+    float step = (to[c] * volume - start) / samples;
+    for(size_t i=0; i<samples; ++i){
+      bus[i] += in[i] * (start + i*step);
+    }
+  }
+  source->gain[l][0] = volume;
+  source->gain[l][1] = volume;
+  heading[0] = D[0];
+  heading[1] = D[1];
+  heading[2] = D[2];
+}
+
+// Decode the bus to a ring of virtual speakers around the listener
+// plus one above and below, which are then panned to the outputs like
+// direct sources. Both steps are folded into one gain per bus channel
+// and output, so the listener's orientation only enters here, once per
+// mix. The gains are ramped from those of the last mix to avoid clicks.
+static void ambisonic_decode(size_t samples, struct space_listener *listener, struct space_mixer_data *data){
+  size_t order = data->ambisonic_order;
+  size_t channels = ambisonic_channels(order);
+  float *weights = data->ambisonic_weights;
+  float *left = listener->left->data;
+  float *right = listener->right->data;
+  float lgain[MAX_AMBISONIC_CHANNELS] = {0}, rgain[MAX_AMBISONIC_CHANNELS] = {0};
+  float Y[MAX_AMBISONIC_CHANNELS];
+  float L[3], D[3] = {listener->direction[0], listener->direction[1], listener->direction[2]};
+  norm(cross(listener->up, listener->direction, L));
+  norm(D);
+
+  for(size_t k=0; k<AMBISONIC_SPEAKERS+2; ++k){
+    float S[3], pan = 0.0;
+    if(k < AMBISONIC_SPEAKERS){
+      float angle = 2.0 * M_PI * k / AMBISONIC_SPEAKERS;
+      pan = sin(angle);
+      S[0] = cos(angle)*D[0] + pan*L[0];
+      S[1] = cos(angle)*D[1] + pan*L[1];
+      S[2] = cos(angle)*D[2] + pan*L[2];
+    }else{
+      // One speaker above and one below, centred.
+      float sign = (k == AMBISONIC_SPEAKERS)? 1.0 : -1.0;
+      S[0] = sign*listener->up[0];
+      S[1] = sign*listener->up[1];
+      S[2] = sign*listener->up[2];
+      norm(S);
+    }
+    float lvolume = (pan < 0.0)? 1.0f+pan : 1.0f;
+    float rvolume = (0.0 < pan)? 1.0f-pan : 1.0f;
+    ambisonic_harmonics(S, order, Y);
+    for(size_t n=0; n<=order; ++n){
+      for(size_t c=n*n; c<(n+1)*(n+1); ++c){
+        lgain[c] += lvolume * weights[n] * Y[c];
+        rgain[c] += rvolume * weights[n] * Y[c];
+      }
+    }
+  }
+  // Normalise so that a source straight ahead is as loud as when
+  // it is panned directly.
+  float front = 0.0;
+  ambisonic_harmonics(D, order, Y);
+  for(size_t c=0; c<channels; ++c){
+    front += lgain[c] * Y[c];
+  }
+  if(front != 0.0){
+    for(size_t c=0; c<channels; ++c){
+      lgain[c] /= front;
+      rgain[c] /= front;
+    }
+  }
+
+  for(size_t c=0; c<channels; ++c){
+    float *bus = listener->bus + c*samples;
+    float lfrom = listener->decode[0][c], lstep = (lgain[c]-lfrom)/samples;
+    float rfrom = listener->decode[1][c], rstep = (rgain[c]-rfrom)/samples;
+    for(size_t i=0; i<samples; ++i){
+      left[i] += (lfrom + i*lstep) * bus[i];
+      right[i] += (rfrom + i*rstep) * bus[i];
+    }
+    listener->decode[0][c] = lgain[c];
+    listener->decode[1][c] = rgain[c];
+  }
+}
+
+// Partially sort the voices such that the first k have the highest scores.
+static void select_voices(struct space_source **voices, size_t count, size_t k){
+  long lo = 0, hi = count-1;
+  while(lo < hi){
+    float pivot = voices[(lo+hi)/2]->score;
+    long i = lo, j = hi;
+    while(i <= j){
+      while(pivot < voices[i]->score) ++i;
+      while(voices[j]->score < pivot) --j;
+      if(i <= j){
+        struct space_source *temp = voices[i];
+        voices[i] = voices[j];
+        voices[j] = temp;
+        ++i; --j;
+      }
+    }
+    if((long)k <= j) hi = j;
+    else if(i <= (long)k) lo = i;
+    else break;
+  }
+}
+
+// Gather the sources within range of the listener that were not
+// already gathered for another listener from the grid.
+static size_t grid_query(struct space_source **considered, size_t count, struct space_listener *listener, struct space_mixer_data *data){
+  size_t stamp = data->stamp;
+  float range = data->max_distance;
+  float *L = listener->location;
+  float lower[3] = {L[0]-range, L[1]-range, L[2]-range};
+  float upper[3] = {L[0]+range, L[1]+range, L[2]+range};
+  long min[3], max[3];
+  grid_cell(lower, data->grid_size, min);
+  grid_cell(upper, data->grid_size, max);
+  double cells = (double)(max[0]-min[0]+1) * (double)(max[1]-min[1]+1) * (double)(max[2]-min[2]+1);
+
+  if(GRID_BUCKETS < cells){
+    // The range covers more cells than there are buckets, so scanning
+    // the buckets directly is cheaper.
+    for(size_t b=0; b<GRID_BUCKETS; ++b){
+      for(struct space_source *source=data->grid[b]; source; source=source->next){
+        if(source->stamp != stamp &&
+           min[0] <= source->cell[0] && source->cell[0] <= max[0] &&
+           min[1] <= source->cell[1] && source->cell[1] <= max[1] &&
+           min[2] <= source->cell[2] && source->cell[2] <= max[2]){
+          source->stamp = stamp;
+          considered[count++] = source;
+        }
+      }
+    }
+  }else{
+    long cell[3];
+    for(cell[0]=min[0]; cell[0]<=max[0]; ++cell[0]){
+      for(cell[1]=min[1]; cell[1]<=max[1]; ++cell[1]){
+        for(cell[2]=min[2]; cell[2]<=max[2]; ++cell[2]){
+          struct space_source *source = data->grid[grid_hash(cell)];
+          for(; source; source=source->next){
+            // Buckets are shared between cells, so filter by the exact cell.
+            if(source->stamp != stamp &&
+               source->cell[0] == cell[0] && source->cell[1] == cell[1] && source->cell[2] == cell[2]){
+              source->stamp = stamp;
+              considered[count++] = source;
+            }
+          }
+        }
+      }
+    }
+  }
+  return count;
+}
+
 int space_mixer_mix(size_t samples, struct mixed_segment *segment){
   struct space_mixer_data *data = (struct space_mixer_data *)segment->data;
+  struct space_source **sources = data->sources;
+  size_t count = data->count;
+  size_t listeners = data->listener_count;
+  size_t audible = 0;
 
-  // Shift frequencies
-  for(size_t s=0; s<data->count; ++s){
-    struct space_source *source = data->sources[s];
-    float pitch = clamp(0.5, calculate_pitch_shift(data, source), 2.0);
-    if(pitch != 1.0){
-      struct mixed_buffer *buffer = source->buffer;
-      pitch_shift(pitch, buffer->data, buffer->data, samples, &data->pitch_data);
+  if(data->grid){
+    sources = data->considered;
+    count = 0;
+    ++data->stamp;
+    for(size_t l=0; l<listeners; ++l){
+      count = grid_query(sources, count, &data->listeners[l], data);
+    }
+    // Voices that were mixed before still need to be faded out.
+    for(size_t s=0; s<data->active_count; ++s){
+      struct space_source *source = data->active[s];
+      if(source->stamp != data->stamp){
+        source->stamp = data->stamp;
+        sources[count++] = source;
+      }
+    }
+    // Sources out of range are virtual as well, so they are still
+    // pulled to keep their position, but nothing else is done for them.
+    for(size_t s=0; s<data->count; ++s){
+      struct space_source *source = data->sources[s];
+      if(source->stamp != data->stamp && source->segment){
+        if(!source->segment->mix(samples, source->segment))
+          memset(source->buffer->data, 0, samples*sizeof(float));
+      }
     }
   }
 
-  float *left = data->left->data;
-  float *right = data->right->data;
-  size_t count = data->count;
-  if(count == 0){
-    memset(left, 0, samples*sizeof(float));
-    memset(right, 0, samples*sizeof(float));
-  }else{
-    float lvolume, rvolume;
-    // Mix the first source directly to avoid a clearing loop.
-    struct space_source *source = data->sources[0];
-    // Invoke segment's mixing function if necessary.
+  // Cheaply determine which sources are audible to any listener.
+  float *distances = data->distances;
+  float *volumes = data->volumes;
+  for(size_t s=0; s<count; ++s){
+    sources[s]->real = 0;
+    sources[s]->score = 0.0;
+  }
+  for(size_t l=0; l<listeners; ++l){
+    float *location = data->listeners[l].location;
+    for(size_t s=0; s<count; ++s){
+      distances[s] = dist(sources[s]->location, location);
+    }
+    attenuation_lookup(&data->attenuation_table, distances, volumes, count);
+    for(size_t s=0; s<count; ++s){
+      struct space_source *source = sources[s];
+      float volume = data->volume * volumes[s];
+      source->distance[l] = distances[s];
+      source->volume[l] = volume;
+      if(source->score < volume) source->score = volume;
+    }
+  }
+  for(size_t s=0; s<count; ++s){
+    struct space_source *source = sources[s];
+    if(AUDIBLE_THRESHOLD <= source->score){
+      source->score *= source->priority;
+      data->voices[audible++] = source;
+    }
+  }
+
+  // Only mix the most important ones if we have too many.
+  if(data->max_voices && data->max_voices < audible){
+    select_voices(data->voices, audible, data->max_voices);
+    audible = data->max_voices;
+  }
+  for(size_t s=0; s<audible; ++s){
+    data->voices[s]->real = 1;
+  }
+
+  for(size_t l=0; l<listeners; ++l){
+    struct space_listener *listener = &data->listeners[l];
+    if(listener->left && listener->right){
+      memset(listener->left->data, 0, samples*sizeof(float));
+      memset(listener->right->data, 0, samples*sizeof(float));
+    }
+    if(listener->bus){
+      memset(listener->bus, 0, ambisonic_channels(data->ambisonic_order)*samples*sizeof(float));
+    }
+  }
+
+  size_t real = 0;
+  for(size_t s=0; s<count; ++s){
+    struct space_source *source = sources[s];
     struct mixed_segment *segment = source->segment;
     float *in = source->buffer->data;
+    bool mixed = 0;
 
+    // Virtual voices still need to be pulled to keep their position.
     if(segment){
-      // FIXME: This is not optimal. Ideally we'd avoid mixing entirely.
       if(!segment->mix(samples, segment))
         memset(in, 0, samples*sizeof(float));
     }
-    
-    // Perform mix.
-    calculate_volumes(&lvolume, &rvolume, source, data);
-    for(size_t i=0; i<samples; ++i){
-      left[i] = in[i] * lvolume;
-      right[i] = in[i] * rvolume;
-    }
-    // Mix the rest of the sources additively.
-    for(size_t s=1; s<count; ++s){
-      source = data->sources[s];
-      // Invoke segment's mixing function if necessary.
-      segment = source->segment;
-      in = source->buffer->data;
-
-      if(segment){
-        if(!segment->mix(samples, segment))
-          memset(in, 0, samples*sizeof(float));
+
+    // The source is only pulled once, the rest is done per listener.
+    for(size_t l=0; l<listeners; ++l){
+      struct space_listener *listener = &data->listeners[l];
+      float *gain = source->gain[l];
+      float lvolume = 0.0, rvolume = 0.0;
+      if(!listener->left || !listener->right) continue;
+
+      if(source->real){
+        if(listener->bus){
+          lvolume = rvolume = source->volume[l];
+        }else{
+          calculate_volumes(&lvolume, &rvolume, source->volume[l], source->distance[l], source, listener, data);
+        }
+      }
+      // A voice that just turned virtual gets faded out during this block.
+      if(lvolume == 0.0 && rvolume == 0.0 && gain[0] == 0.0 && gain[1] == 0.0){
+        continue;
+      }
+      mixed = 1;
+
+      // Shift frequencies
+      float *shifted = in;
+      float pitch = clamp(0.5, calculate_pitch_shift(data, listener, source), 2.0);
+      if(pitch != 1.0){
+        shifted = data->shifted;
+        pitch_shift(pitch, in, shifted, samples, &listener->pitch_data);
       }
 
-      // Perform mix.
-      calculate_volumes(&lvolume, &rvolume, source, data);
+      if(listener->bus){
+        ambisonic_encode(shifted, samples, lvolume, source, l, listener, data);
+        continue;
+      }
+
+      // Perform mix, ramping from the last volume to avoid clicks.
+      float *left = listener->left->data;
+      float *right = listener->right->data;
+      float lfrom = gain[0], lstep = (lvolume-lfrom)/samples;
+      float rfrom = gain[1], rstep = (rvolume-rfrom)/samples;
       for(size_t i=0; i<samples; ++i){
-        left[i] += in[i] * lvolume;
-        right[i] += in[i] * rvolume;
+        left[i] += shifted[i] * (lfrom + i*lstep);
+        right[i] += shifted[i] * (rfrom + i*rstep);
       }
+      gain[0] = lvolume;
+      gain[1] = rvolume;
     }
+    if(mixed){
+      data->active[real++] = source;
+    }
+  }
+  for(size_t l=0; l<listeners; ++l){
+    struct space_listener *listener = &data->listeners[l];
+    if(listener->bus && listener->left && listener->right){
+      ambisonic_decode(samples, listener, data);
+    }
+  }
+  data->active_count = real;
+  data->real_voices = real;
+  data->virtual_voices = data->count - real;
+  return 1;
+}
+
+static int set_listener_field(size_t field, float *value, struct space_listener *listener){
+  float *target;
+  switch(field){
+  case MIXED_SPACE_LOCATION: target = listener->location; break;
+  case MIXED_SPACE_VELOCITY: target = listener->velocity; break;
+  case MIXED_SPACE_DIRECTION: target = listener->direction; break;
+  case MIXED_SPACE_UP: target = listener->up; break;
+  default: mixed_err(MIXED_INVALID_FIELD); return 0;
+  }
+  target[0] = value[0];
+  target[1] = value[1];
+  target[2] = value[2];
+  return 1;
+}
+
+static int get_listener_field(size_t field, float *value, struct space_listener *listener){
+  float *source;
+  switch(field){
+  case MIXED_SPACE_LOCATION: source = listener->location; break;
+  case MIXED_SPACE_VELOCITY: source = listener->velocity; break;
+  case MIXED_SPACE_DIRECTION: source = listener->direction; break;
+  case MIXED_SPACE_UP: source = listener->up; break;
+  default: mixed_err(MIXED_INVALID_FIELD); return 0;
   }
+  value[0] = source[0];
+  value[1] = source[1];
+  value[2] = source[2];
   return 1;
 }
 
 int space_mixer_set_out(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
   struct space_mixer_data *data = (struct space_mixer_data *)segment->data;
-  
+  size_t index = location / 2;
+
   switch(field){
   case MIXED_BUFFER:
-    switch(location){
-    case MIXED_LEFT: data->left = (struct mixed_buffer *)buffer; return 1;
-    case MIXED_RIGHT: data->right = (struct mixed_buffer *)buffer; return 1;
-    default: mixed_err(MIXED_INVALID_LOCATION); return 0;
+    if(MAX_LISTENERS <= index || (data->listener_count <= index && !buffer)){
+      mixed_err(MIXED_INVALID_LOCATION);
+      return 0;
+    }
+    if(buffer){
+      // Make sure we can hold the shifted samples of a source.
+      struct mixed_buffer *new = (struct mixed_buffer *)buffer;
+      size_t listener_count = data->listener_count;
+      size_t shifted_size = data->shifted_size;
+      if(data->shifted_size < new->size){
+        float *shifted = crealloc(data->shifted, data->shifted_size, new->size, sizeof(float));
+        if(!shifted){
+          mixed_err(MIXED_OUT_OF_MEMORY);
+          return 0;
+        }
+        data->shifted = shifted;
+        data->shifted_size = new->size;
+      }
+      for(; data->listener_count <= index; ++data->listener_count){
+        if(!make_listener(data, &data->listeners[data->listener_count]))
+          return 0;
+      }
+      // The buses need to grow along with the shifted buffer.
+      if(data->ambisonic_order && (listener_count < data->listener_count || shifted_size < data->shifted_size)){
+        if(!resize_buses(data->ambisonic_order, data))
+          return 0;
+      }
+    }
+    struct space_listener *listener = &data->listeners[index];
+    switch(location % 2){
+    case MIXED_LEFT: listener->left = (struct mixed_buffer *)buffer; break;
+    case MIXED_RIGHT: listener->right = (struct mixed_buffer *)buffer; break;
+    }
+    // Drop listeners at the end that no longer have any buffers.
+    while(1 < data->listener_count){
+      listener = &data->listeners[data->listener_count-1];
+      if(listener->left || listener->right) break;
+      free_listener(listener);
+      --data->listener_count;
+    }
+    return 1;
+  case MIXED_SPACE_LOCATION:
+  case MIXED_SPACE_VELOCITY:
+  case MIXED_SPACE_DIRECTION:
+  case MIXED_SPACE_UP:
+    if(data->listener_count <= index){
+      mixed_err(MIXED_INVALID_LOCATION);
+      return 0;
     }
+    return set_listener_field(field, (float *)buffer, &data->listeners[index]);
   default:
     mixed_err(MIXED_INVALID_FIELD);
     return 0;
@@ -240,14 +897,25 @@ int space_mixer_set_out(size_t field, size_t location, void *buffer, struct mixe
 
 int space_mixer_get_out(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
   struct space_mixer_data *data = (struct space_mixer_data *)segment->data;
-  
+  size_t index = location / 2;
+
+  if(data->listener_count <= index){
+    mixed_err(MIXED_INVALID_LOCATION);
+    return 0;
+  }
+  struct space_listener *listener = &data->listeners[index];
+
   switch(field){
   case MIXED_BUFFER:
-    switch(location){
-    case MIXED_LEFT: *(struct mixed_buffer **)buffer = data->left; return 1;
-    case MIXED_RIGHT: *(struct mixed_buffer **)buffer = data->right; return 1;
-    default: mixed_err(MIXED_INVALID_LOCATION); return 0;
+    switch(location % 2){
+    case MIXED_LEFT: *(struct mixed_buffer **)buffer = listener->left; return 1;
+    case MIXED_RIGHT: *(struct mixed_buffer **)buffer = listener->right; return 1;
     }
+  case MIXED_SPACE_LOCATION:
+  case MIXED_SPACE_VELOCITY:
+  case MIXED_SPACE_DIRECTION:
+  case MIXED_SPACE_UP:
+    return get_listener_field(field, (float *)buffer, listener);
   default:
     mixed_err(MIXED_INVALID_FIELD);
     return 0;
@@ -269,20 +937,42 @@ int space_mixer_set_in(size_t field, size_t location, void *buffer, struct mixed
           return 0;
         }
         source->buffer = (struct mixed_buffer *)buffer;
-        return vector_add(source, (struct vector *)data);
+        source->priority = 1.0;
+        if(!vector_add(source, (struct vector *)data)){
+          free(source);
+          return 0;
+        }
+        // Make sure we have enough space to select voices from.
+        if(!ensure_scratch(data)){
+          vector_remove_pos(data->count-1, (struct vector *)data);
+          free(source);
+          return 0;
+        }
+        if(data->grid){
+          grid_insert(source, data);
+        }
       }
     }else{ // Remove an element
       if(data->count <= location){
         mixed_err(MIXED_INVALID_LOCATION);
         return 0;
       }
-      free(data->sources[location]);
+      struct space_source *source = data->sources[location];
+      grid_remove(source);
+      for(size_t s=0; s<data->active_count; ++s){
+        if(data->active[s] == source){
+          data->active[s] = data->active[--data->active_count];
+          break;
+        }
+      }
+      free(source);
       return vector_remove_pos(location, (struct vector *)data);
     }
     return 1;
   case MIXED_SOURCE:
   case MIXED_SPACE_LOCATION:
   case MIXED_SPACE_VELOCITY:
+  case MIXED_SPACE_PRIORITY:
     if(data->count <= location){
       mixed_err(MIXED_INVALID_LOCATION);
       return 0;
@@ -297,12 +987,22 @@ int space_mixer_set_in(size_t field, size_t location, void *buffer, struct mixed
       source->location[0] = value[0];
       source->location[1] = value[1];
       source->location[2] = value[2];
+      if(data->grid){
+        grid_update(source, data);
+      }
       break;
     case MIXED_SPACE_VELOCITY:
       source->velocity[0] = value[0];
       source->velocity[1] = value[1];
       source->velocity[2] = value[2];
       break;
+    case MIXED_SPACE_PRIORITY:
+      if(*value < 0.0){
+        mixed_err(MIXED_INVALID_VALUE);
+        return 0;
+      }
+      source->priority = *value;
+      break;
     }
     return 1;
   default:
@@ -328,6 +1028,9 @@ int space_mixer_get_in(size_t field, size_t location, void *buffer, struct mixed
   case MIXED_BUFFER:
     *(struct mixed_buffer **)buffer = source->buffer;
     return 1;
+  case MIXED_SPACE_PRIORITY:
+    *(float *)buffer = source->priority;
+    return 1;
   case MIXED_SPACE_LOCATION:
   case MIXED_SPACE_VELOCITY:{
     float *value = (float *)buffer;
@@ -358,25 +1061,10 @@ int space_mixer_get(size_t field, void *value, struct mixed_segment *segment){
     *((float *)value) = data->volume;
     break;
   case MIXED_SPACE_LOCATION:
-    parts[0] = data->location[0];
-    parts[1] = data->location[1];
-    parts[2] = data->location[2];
-    break;
   case MIXED_SPACE_VELOCITY:
-    parts[0] = data->velocity[0];
-    parts[1] = data->velocity[1];
-    parts[2] = data->velocity[2];
-    break;
   case MIXED_SPACE_DIRECTION:
-    parts[0] = data->direction[0];
-    parts[1] = data->direction[1];
-    parts[2] = data->direction[2];
-    break;
   case MIXED_SPACE_UP:
-    parts[0] = data->up[0];
-    parts[1] = data->up[1];
-    parts[2] = data->up[2];
-    break;
+    return get_listener_field(field, parts, &data->listeners[0]);
   case MIXED_SPACE_SOUNDSPEED:
     *(float *)value = data->soundspeed;
     break;
@@ -405,6 +1093,34 @@ int space_mixer_get(size_t field, void *value, struct mixed_segment *segment){
       *(float (**)(float min, float max, float dist, float roll))value = data->attenuation;
     }
     break;
+  case MIXED_SPACE_MAX_VOICES:
+    *(size_t *)value = data->max_voices;
+    break;
+  case MIXED_SPACE_REAL_VOICES:
+    *(size_t *)value = data->real_voices;
+    break;
+  case MIXED_SPACE_VIRTUAL_VOICES:
+    *(size_t *)value = data->virtual_voices;
+    break;
+  case MIXED_SPACE_GRID_SIZE:
+    *(float *)value = data->grid_size;
+    break;
+  case MIXED_SPACE_AMBISONIC_ORDER:
+    *(size_t *)value = data->ambisonic_order;
+    break;
+  case MIXED_PITCH_FRAMESIZE:
+    *(size_t *)value = data->pitch_framesize;
+    break;
+  case MIXED_PITCH_OVERSAMPLING:
+    *(size_t *)value = data->pitch_oversampling;
+    break;
+  case MIXED_FAST_MATH:
+    *(bool *)value = data->fast_math;
+    break;
+  case MIXED_LATENCY:
+    // Only sources that are doppler shifted are delayed.
+    *(size_t *)value = (0.0 < data->doppler_factor)? pitch_latency(&data->listeners[0].pitch_data) : 0;
+    break;
   default:
     mixed_err(MIXED_INVALID_FIELD);
     return 0;
@@ -420,24 +1136,10 @@ int space_mixer_set(size_t field, void *value, struct mixed_segment *segment){
     data->volume = *((float *)value);
     break;
   case MIXED_SPACE_LOCATION:
-    data->location[0] = parts[0];
-    data->location[1] = parts[1];
-    data->location[2] = parts[2];
-    break;
   case MIXED_SPACE_VELOCITY:
-    data->velocity[0] = parts[0];
-    data->velocity[1] = parts[1];
-    data->velocity[2] = parts[2];
   case MIXED_SPACE_DIRECTION:
-    data->direction[0] = parts[0];
-    data->direction[1] = parts[1];
-    data->direction[2] = parts[2];
-    break;
   case MIXED_SPACE_UP:
-    data->up[0] = parts[0];
-    data->up[1] = parts[1];
-    data->up[2] = parts[2];
-    break;
+    return set_listener_field(field, parts, &data->listeners[0]);
   case MIXED_SPACE_SOUNDSPEED:
     data->soundspeed = *(float *)value;
     break;
@@ -446,12 +1148,15 @@ int space_mixer_set(size_t field, void *value, struct mixed_segment *segment){
     break;
   case MIXED_SPACE_MIN_DISTANCE:
     data->min_distance = *(float *)value;
+    update_attenuation_table(data);
     break;
   case MIXED_SPACE_MAX_DISTANCE:
     data->max_distance = *(float *)value;
+    update_attenuation_table(data);
     break;
   case MIXED_SPACE_ROLLOFF:
     data->rolloff = *(float *)value;
+    update_attenuation_table(data);
     break;
   case MIXED_SPACE_ATTENUATION:
     switch(*(size_t *)value){
@@ -471,7 +1176,48 @@ int space_mixer_set(size_t field, void *value, struct mixed_segment *segment){
       data->attenuation = (float (*)(float min, float max, float dist, float roll))value;
       break;
     }
+    update_attenuation_table(data);
+    break;
+  case MIXED_SPACE_MAX_VOICES:
+    data->max_voices = *(size_t *)value;
     break;
+  case MIXED_SPACE_GRID_SIZE:
+    if(*(float *)value < 0.0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    return grid_resize(*(float *)value, data);
+  case MIXED_SPACE_AMBISONIC_ORDER:
+    if(MAX_AMBISONIC_ORDER < *(size_t *)value){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    return resize_buses(*(size_t *)value, data);
+  case MIXED_FAST_MATH:
+    data->fast_math = *(bool *)value;
+    for(size_t l=0; l<data->listener_count; ++l){
+      pitch_fast_math(data->fast_math, &data->listeners[l].pitch_data);
+    }
+    break;
+  case MIXED_PITCH_FRAMESIZE:
+  case MIXED_PITCH_OVERSAMPLING:{
+    size_t framesize = (field == MIXED_PITCH_FRAMESIZE)? *(size_t *)value : data->pitch_framesize;
+    size_t oversampling = (field == MIXED_PITCH_OVERSAMPLING)? *(size_t *)value : data->pitch_oversampling;
+    // Every listener is prepared first, so that either all of them
+    // switch or none does.
+    struct pitch_data next[MAX_LISTENERS];
+    for(size_t l=0; l<data->listener_count; ++l){
+      if(!prepare_pitch_data(framesize, oversampling, data->samplerate, &data->listeners[l].pitch_data, &next[l])){
+        while(0 < l) free_pitch_data(&next[--l]);
+        return 0;
+      }
+    }
+    for(size_t l=0; l<data->listener_count; ++l){
+      commit_pitch_data(&next[l], &data->listeners[l].pitch_data);
+    }
+    data->pitch_framesize = framesize;
+    data->pitch_oversampling = oversampling;
+    break;}
   default:
     mixed_err(MIXED_INVALID_FIELD);
     return 0;
@@ -480,12 +1226,13 @@ int space_mixer_set(size_t field, void *value, struct mixed_segment *segment){
 }
 
 int space_mixer_info(struct mixed_segment_info *info, struct mixed_segment *segment){
+  struct space_mixer_data *data = (struct space_mixer_data *)segment->data;
   info->name = "space_mixer";
   info->description = "Mixes multiple sources while simulating 3D space.";
-  info->flags = MIXED_MODIFIES_INPUT;
+  info->flags = 0;
   info->min_inputs = 0;
   info->max_inputs = -1;
-  info->outputs = 2;
+  info->outputs = 2*data->listener_count;
     
   struct mixed_segment_field_info *field = info->fields;
   set_info_field(field++, MIXED_BUFFER,
@@ -497,19 +1244,19 @@ int space_mixer_info(struct mixed_segment_info *info, struct mixed_segment *segm
                  "The volume scaling factor for the output.");
 
   set_info_field(field++, MIXED_SPACE_LOCATION,
-                 MIXED_FLOAT, 3, MIXED_IN | MIXED_SEGMENT | MIXED_SET | MIXED_GET,
-                 "The location of the source or segment (listener) in space.");
+                 MIXED_FLOAT, 3, MIXED_IN | MIXED_OUT | MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The location of the source or listener in space.");
 
   set_info_field(field++, MIXED_SPACE_VELOCITY,
-                 MIXED_FLOAT, 3, MIXED_IN | MIXED_SEGMENT | MIXED_SET | MIXED_GET,
-                 "The velocity of the source or segment (listener) in space.");
+                 MIXED_FLOAT, 3, MIXED_IN | MIXED_OUT | MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The velocity of the source or listener in space.");
 
   set_info_field(field++, MIXED_SPACE_DIRECTION,
-                 MIXED_FLOAT, 3, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
-                 "The direction the segment is facing in space.");
+                 MIXED_FLOAT, 3, MIXED_OUT | MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The direction the listener is facing in space.");
 
   set_info_field(field++, MIXED_SPACE_UP,
-                 MIXED_FLOAT, 3, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 MIXED_FLOAT, 3, MIXED_OUT | MIXED_SEGMENT | MIXED_SET | MIXED_GET,
                  "The vector designating 'upwards' in space.");
 
   set_info_field(field++, MIXED_SPACE_SOUNDSPEED,
@@ -526,7 +1273,7 @@ int space_mixer_info(struct mixed_segment_info *info, struct mixed_segment *segm
 
   set_info_field(field++, MIXED_SPACE_MAX_DISTANCE,
                  MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
-                 "Any distance greater than this will make the sound appear at its minimal volume.");
+                 "Any source further away than this is inaudible and becomes a virtual voice.");
 
   set_info_field(field++, MIXED_SPACE_ROLLOFF,
                  MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
@@ -540,6 +1287,46 @@ int space_mixer_info(struct mixed_segment_info *info, struct mixed_segment *segm
                  MIXED_SEGMENT_POINTER, 1, MIXED_IN | MIXED_SET | MIXED_GET,
                  "The segment that needs to be mixed before its buffer has any useful data.");
 
+  set_info_field(field++, MIXED_SPACE_PRIORITY,
+                 MIXED_FLOAT, 1, MIXED_IN | MIXED_SET | MIXED_GET,
+                 "The priority of the source when deciding which voices to mix.");
+
+  set_info_field(field++, MIXED_SPACE_MAX_VOICES,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The maximal number of sources that are actually mixed. Zero means no limit.");
+
+  set_info_field(field++, MIXED_SPACE_REAL_VOICES,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_GET,
+                 "The number of sources that were mixed in the last block.");
+
+  set_info_field(field++, MIXED_SPACE_VIRTUAL_VOICES,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_GET,
+                 "The number of sources that were only advanced in the last block.");
+
+  set_info_field(field++, MIXED_SPACE_GRID_SIZE,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The cell size of the spatial index used to cull sources. Zero disables it.");
+
+  set_info_field(field++, MIXED_SPACE_AMBISONIC_ORDER,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The order of the ambisonic bus sources are encoded into. Zero pans directly.");
+
+  set_info_field(field++, MIXED_PITCH_FRAMESIZE,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The frame size of the phase vocoder used for the doppler effect.");
+
+  set_info_field(field++, MIXED_PITCH_OVERSAMPLING,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The oversampling factor of the phase vocoder used for the doppler effect.");
+
+  set_info_field(field++, MIXED_FAST_MATH,
+                 MIXED_BOOL, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "Whether the phase vocoder used for the doppler effect approximates its trigonometry.");
+
+  set_info_field(field++, MIXED_LATENCY,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_GET,
+                 "The delay of doppler shifted sources in samples.");
+
   clear_info_field(field++);
   return 1;
 }
@@ -551,14 +1338,16 @@ MIXED_EXPORT int mixed_make_segment_space_mixer(size_t samplerate, struct mixed_
     return 0;
   }
 
-  // These factors might need tweaking for efficiency/quality.
-  if(!make_pitch_data(2048, 4, samplerate, &data->pitch_data)){
+  data->samplerate = samplerate;
+  data->pitch_framesize = 2048;
+  data->pitch_oversampling = 4;
+  data->fast_math = 1;
+  if(!make_listener(data, &data->listeners[0])){
     free(data);
     return 0;
   }
 
-  data->direction[2] = 1.0;      // Facing in Z+ direction
-  data->up[1] = 1.0;             // OpenGL-like. Y+ is up.
+  data->listener_count = 1;
   data->soundspeed = 34330.0;    // Means units are in [cm].
   data->doppler_factor = 1.0;
   data->min_distance = 10.0;      // That's 10 centimetres.
@@ -566,6 +1355,7 @@ MIXED_EXPORT int mixed_make_segment_space_mixer(size_t samplerate, struct mixed_
   data->rolloff = 0.5;
   data->attenuation = attenuation_exponential;
   data->volume = 1.0;
+  update_attenuation_table(data);
   
   segment->free = space_mixer_free;
   segment->info = space_mixer_info;
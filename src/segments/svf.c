@@ -0,0 +1,263 @@
+#include "internal.h"
+
+// A state variable filter in the topology-preserving form described by
+// Vadim Zavalishin and Andrew Simper. Unlike a biquad, its state stays
+// valid when the coefficients change, so the cutoff can be modulated at
+// audio rate without clicks. Every sample produces the low, high, band
+// and notch responses at the same time.
+
+struct svf_segment_data{
+  struct mixed_buffer *in;
+  struct mixed_buffer *cutoff_in;
+  struct mixed_buffer *low;
+  struct mixed_buffer *high;
+  struct mixed_buffer *band;
+  struct mixed_buffer *notch;
+  float ic1;
+  float ic2;
+  float cutoff;
+  float target;
+  float resonance;
+  size_t samplerate;
+  bool fast_math;
+};
+
+// The prewarped cutoff. It is computed per sample while the cutoff
+// moves, which is where the fast tan pays off.
+static inline float svf_gain(float cutoff, float nyquist, bool fast){
+  // Keep the cutoff clear of DC and of the pole of tan at nyquist.
+  if(cutoff < 1.0f) cutoff = 1.0f;
+  if(0.98f*nyquist < cutoff) cutoff = 0.98f*nyquist;
+  float x = M_PI_2*cutoff/nyquist;
+  return (fast)? fast_tan(x) : tanf(x);
+}
+
+int svf_segment_free(struct mixed_segment *segment){
+  if(segment->data){
+    free(segment->data);
+  }
+  segment->data = 0;
+  return 1;
+}
+
+int svf_segment_start(struct mixed_segment *segment){
+  struct svf_segment_data *data = (struct svf_segment_data *)segment->data;
+  data->ic1 = 0.0;
+  data->ic2 = 0.0;
+  data->cutoff = data->target;
+  return 1;
+}
+
+int svf_segment_set_in(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
+  struct svf_segment_data *data = (struct svf_segment_data *)segment->data;
+
+  switch(field){
+  case MIXED_BUFFER:
+    switch(location){
+    case 0: data->in = (struct mixed_buffer *)buffer; return 1;
+    case 1: data->cutoff_in = (struct mixed_buffer *)buffer; return 1;
+    default: mixed_err(MIXED_INVALID_LOCATION); return 0;
+    }
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+}
+
+int svf_segment_set_out(size_t field, size_t location, void *buffer, struct mixed_segment *segment){
+  struct svf_segment_data *data = (struct svf_segment_data *)segment->data;
+
+  switch(field){
+  case MIXED_BUFFER:
+    switch(location){
+    case MIXED_SVF_LOW: data->low = (struct mixed_buffer *)buffer; return 1;
+    case MIXED_SVF_HIGH: data->high = (struct mixed_buffer *)buffer; return 1;
+    case MIXED_SVF_BAND: data->band = (struct mixed_buffer *)buffer; return 1;
+    case MIXED_SVF_NOTCH: data->notch = (struct mixed_buffer *)buffer; return 1;
+    default: mixed_err(MIXED_INVALID_LOCATION); return 0;
+    }
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+}
+
+int svf_segment_mix(size_t samples, struct mixed_segment *segment){
+  struct svf_segment_data *data = (struct svf_segment_data *)segment->data;
+  if(samples == 0) return 1;
+
+  float *in = data->in->data;
+  float *low = data->low->data;
+  float *high = data->high->data;
+  float *band = data->band->data;
+  float *notch = data->notch->data;
+  float *cutoff = (data->cutoff_in)? data->cutoff_in->data : 0;
+  float nyquist = data->samplerate/2.0f;
+  float k = 1.0f/data->resonance;
+  float ic1 = data->ic1, ic2 = data->ic2;
+  // Without a control buffer the cutoff is ramped towards its target
+  // over the course of the block.
+  float from = data->cutoff;
+  float step = (data->target - from)/samples;
+  bool fixed = (!cutoff && step == 0.0f);
+  bool fast = data->fast_math;
+  float g = svf_gain(from, nyquist, fast);
+  float a1 = 1.0f/(1.0f + g*(g + k));
+  float a2 = g*a1;
+  float a3 = g*a2;
+
+  for(size_t i=0; i<samples; ++i){
+    if(!fixed){
+      g = svf_gain((cutoff)? cutoff[i] : from+step*(i+1), nyquist, fast);
+      a1 = 1.0f/(1.0f + g*(g + k));
+      a2 = g*a1;
+      a3 = g*a2;
+    }
+    float x = in[i];
+    float v3 = x - ic2;
+    float v1 = a1*ic1 + a2*v3;
+    float v2 = ic2 + a2*ic1 + a3*v3;
+    ic1 = 2.0f*v1 - ic1;
+    ic2 = 2.0f*v2 - ic2;
+    low[i] = v2;
+    band[i] = v1;
+    high[i] = x - k*v1 - v2;
+    notch[i] = x - k*v1;
+  }
+
+  data->ic1 = ic1;
+  data->ic2 = ic2;
+  data->cutoff = (cutoff)? cutoff[samples-1] : data->target;
+  return 1;
+}
+
+int svf_segment_mix_bypass(size_t samples, struct mixed_segment *segment){
+  struct svf_segment_data *data = (struct svf_segment_data *)segment->data;
+
+  mixed_buffer_copy(data->in, data->low);
+  mixed_buffer_copy(data->in, data->high);
+  mixed_buffer_copy(data->in, data->band);
+  mixed_buffer_copy(data->in, data->notch);
+  return 1;
+}
+
+int svf_segment_info(struct mixed_segment_info *info, struct mixed_segment *segment){
+  info->name = "svf";
+  info->description = "A state variable filter with modulatable cutoff.";
+  info->flags = MIXED_INPLACE;
+  info->min_inputs = 1;
+  info->max_inputs = 2;
+  info->outputs = 4;
+
+  struct mixed_segment_field_info *field = info->fields;
+  set_info_field(field++, MIXED_BUFFER,
+                 MIXED_BUFFER_POINTER, 1, MIXED_IN | MIXED_OUT | MIXED_SET,
+                 "The buffer for audio data attached to the location. Input 1 is the optional cutoff in Hz.");
+
+  set_info_field(field++, MIXED_SVF_CUTOFF,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The cutoff frequency in Hz, used when there is no cutoff input.");
+
+  set_info_field(field++, MIXED_SVF_RESONANCE,
+                 MIXED_FLOAT, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The quality factor of the filter.");
+
+  set_info_field(field++, MIXED_FAST_MATH,
+                 MIXED_BOOL, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "Whether to approximate tan for the cutoff.");
+
+  set_info_field(field++, MIXED_SAMPLERATE,
+                 MIXED_SIZE_T, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "The samplerate at which the segment operates.");
+
+  set_info_field(field++, MIXED_BYPASS,
+                 MIXED_BOOL, 1, MIXED_SEGMENT | MIXED_SET | MIXED_GET,
+                 "Bypass the segment's processing.");
+
+  clear_info_field(field++);
+  return 1;
+}
+
+int svf_segment_get(size_t field, void *value, struct mixed_segment *segment){
+  struct svf_segment_data *data = (struct svf_segment_data *)segment->data;
+  switch(field){
+  case MIXED_SVF_CUTOFF: *((float *)value) = data->target; break;
+  case MIXED_SVF_RESONANCE: *((float *)value) = data->resonance; break;
+  case MIXED_FAST_MATH: *((bool *)value) = data->fast_math; break;
+  case MIXED_SAMPLERATE: *((size_t *)value) = data->samplerate; break;
+  case MIXED_BYPASS: *((bool *)value) = (segment->mix == svf_segment_mix_bypass); break;
+  default: mixed_err(MIXED_INVALID_FIELD); return 0;
+  }
+  return 1;
+}
+
+int svf_segment_set(size_t field, void *value, struct mixed_segment *segment){
+  struct svf_segment_data *data = (struct svf_segment_data *)segment->data;
+  switch(field){
+  case MIXED_SVF_CUTOFF:
+    if(*(float *)value <= 0.0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->target = *(float *)value;
+    break;
+  case MIXED_SVF_RESONANCE:
+    if(*(float *)value <= 0.0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->resonance = *(float *)value;
+    break;
+  case MIXED_FAST_MATH:
+    data->fast_math = *(bool *)value;
+    break;
+  case MIXED_SAMPLERATE:
+    if(*(size_t *)value <= 0){
+      mixed_err(MIXED_INVALID_VALUE);
+      return 0;
+    }
+    data->samplerate = *(size_t *)value;
+    break;
+  case MIXED_BYPASS:
+    if(*(bool *)value){
+      segment->mix = svf_segment_mix_bypass;
+    }else{
+      segment->mix = svf_segment_mix;
+    }
+    break;
+  default:
+    mixed_err(MIXED_INVALID_FIELD);
+    return 0;
+  }
+  return 1;
+}
+
+MIXED_EXPORT int mixed_make_segment_svf(float cutoff, size_t samplerate, struct mixed_segment *segment){
+  if(cutoff <= 0.0 || samplerate == 0){
+    mixed_err(MIXED_INVALID_VALUE);
+    return 0;
+  }
+
+  struct svf_segment_data *data = calloc(1, sizeof(struct svf_segment_data));
+  if(!data){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    return 0;
+  }
+
+  data->cutoff = cutoff;
+  data->target = cutoff;
+  data->resonance = M_SQRT1_2;
+  data->samplerate = samplerate;
+  data->fast_math = 1;
+
+  segment->free = svf_segment_free;
+  segment->start = svf_segment_start;
+  segment->mix = svf_segment_mix;
+  segment->set_in = svf_segment_set_in;
+  segment->set_out = svf_segment_set_out;
+  segment->info = svf_segment_info;
+  segment->get = svf_segment_get;
+  segment->set = svf_segment_set;
+  segment->data = data;
+  return 1;
+}
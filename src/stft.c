@@ -0,0 +1,119 @@
+#include "internal.h"
+
+// Every step of framesize/oversampling samples, the last framesize
+// samples of the input are windowed and transformed, the spectrum is
+// passed through the stages, and the inverse transform is windowed
+// again and added onto the output. A sample is complete once the last
+// frame covering it has been added, so the output lags behind the input
+// by a full frame.
+
+void free_stft_data(struct stft_data *data){
+  release_fft_tables(data->tables);
+  data->tables = 0;
+
+  free_vector(&data->stages);
+  data->stages.count = 0;
+  data->stages.size = 0;
+
+  // All per-instance arrays are carved out of one allocation.
+  if(data->in_fifo)
+    free(data->in_fifo);
+  data->in_fifo = 0;
+  data->out_fifo = 0;
+  data->accumulator = 0;
+  data->spectrum = 0;
+}
+
+int make_stft_data(size_t framesize, size_t oversampling, struct stft_data *data){
+  if(oversampling < 2 || (oversampling & (oversampling-1)) || framesize < oversampling){
+    mixed_err(MIXED_INVALID_VALUE);
+    return 0;
+  }
+
+  float *memory = calloc(framesize*5 + 2, sizeof(float));
+  if(!memory){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    return 0;
+  }
+
+  data->tables = acquire_fft_tables(framesize, oversampling);
+  if(!data->tables){
+    free(memory);
+    return 0;
+  }
+
+  data->in_fifo = memory; memory += framesize;
+  data->out_fifo = memory; memory += framesize;
+  data->accumulator = memory; memory += framesize*2;
+  data->spectrum = memory; memory += framesize+2;
+
+  data->stages.data = 0;
+  data->stages.count = 0;
+  data->stages.size = 0;
+  data->framesize = framesize;
+  data->oversampling = oversampling;
+  data->fill = framesize - framesize/oversampling;
+  return 1;
+}
+
+int stft_add_stage(struct stft_stage *stage, struct stft_data *data){
+  return vector_add(stage, &data->stages);
+}
+
+int stft_remove_stage(struct stft_stage *stage, struct stft_data *data){
+  return vector_remove_item(stage, &data->stages);
+}
+
+size_t stft_latency(struct stft_data *data){
+  return data->framesize;
+}
+
+static void stft_frame(struct stft_data *data){
+  size_t framesize = data->framesize;
+  size_t step = framesize/data->oversampling;
+  float *in_fifo = data->in_fifo;
+  float *accumulator = data->accumulator;
+  float *spectrum = data->spectrum;
+  float *window = data->tables->window;
+  float *synthesis_window = data->tables->synthesis_window;
+  struct fft_plan *plan = &data->tables->plan;
+
+  for(size_t k=0; k<framesize; ++k){
+    spectrum[k] = in_fifo[k] * window[k];
+  }
+  fft_forward(spectrum, spectrum, plan);
+
+  for(size_t s=0; s<data->stages.count; ++s){
+    struct stft_stage *stage = data->stages.data[s];
+    stage->process(spectrum, data, stage->user);
+  }
+
+  fft_inverse(spectrum, spectrum, plan);
+  for(size_t k=0; k<framesize; ++k){
+    accumulator[k] += synthesis_window[k] * spectrum[k];
+  }
+
+  memcpy(data->out_fifo, accumulator, step*sizeof(float));
+  memmove(accumulator, accumulator+step, framesize*sizeof(float));
+  memmove(in_fifo, in_fifo+step, (framesize-step)*sizeof(float));
+}
+
+void stft_process(float *in, float *out, size_t samples, struct stft_data *data){
+  size_t framesize = data->framesize;
+  size_t overlap = framesize - framesize/data->oversampling;
+  size_t i = 0;
+
+  while(i < samples){
+    size_t chunk = smin(samples-i, framesize-data->fill);
+    // The input is taken first, as the output may be the same buffer.
+    memcpy(data->in_fifo+data->fill, in+i, chunk*sizeof(float));
+    memcpy(out+i, data->out_fifo+data->fill-overlap, chunk*sizeof(float));
+    data->fill += chunk;
+    i += chunk;
+
+    if(data->fill == framesize){
+      stft_frame(data);
+      data->fill = overlap;
+    }
+  }
+}
@@ -0,0 +1,214 @@
+#include "internal.h"
+
+// Time-domain pitch shifting through waveform similarity overlap-add.
+//
+// Every hop, a grain is read from the input history with a step of the
+// pitch factor, which shifts its pitch, and is overlap-added into the
+// output with a Hann window. The grains start at a fixed delay behind
+// the input, so the input is consumed in real time. To avoid phase
+// cancellation between grains, each grain start is moved within the
+// search range to where the input best matches the natural continuation
+// of the previous grain. That match is found through a cross-correlation
+// computed with the FFT.
+
+#define WSOLA_MIN_PITCH 0.5
+#define WSOLA_MAX_PITCH 2.0
+
+void free_wsola_data(struct wsola_data *data){
+  release_fft_tables(data->tables);
+  data->tables = 0;
+
+  // All per-instance arrays are carved out of one allocation.
+  if(data->history)
+    free(data->history);
+  data->history = 0;
+  data->window = 0;
+  data->ola = 0;
+  data->ready = 0;
+  data->search = 0;
+  data->target = 0;
+  data->energy = 0;
+}
+
+int make_wsola_data(size_t samplerate, struct wsola_data *data){
+  // Grains of 4.5ms, searched within half a grain, keep the latency
+  // below 10ms over the whole pitch range. See wsola_latency.
+  size_t hop = samplerate*9/4000;
+  if(hop < 16) hop = 16;
+  size_t grain = 2*hop;
+  size_t range = hop;
+  size_t overlap = grain - hop;
+  size_t history = 1;
+  while(history < 2*range + overlap + grain*(WSOLA_MAX_PITCH+1)) history <<= 1;
+  size_t correlation = 1;
+  while(correlation < overlap + 2*range) correlation <<= 1;
+
+  float *memory = calloc(history + 2*grain + hop + 2*(correlation+2) + 2*range+1, sizeof(float));
+  if(!memory){
+    mixed_err(MIXED_OUT_OF_MEMORY);
+    return 0;
+  }
+
+  data->tables = acquire_fft_tables(correlation, 1);
+  if(!data->tables){
+    free(memory);
+    return 0;
+  }
+
+  data->history = memory; memory += history;
+  data->window = memory; memory += grain;
+  data->ola = memory; memory += grain;
+  data->ready = memory; memory += hop;
+  data->search = memory; memory += correlation+2;
+  data->target = memory; memory += correlation+2;
+  data->energy = memory; memory += 2*range+1;
+
+  for(size_t i=0; i<grain; ++i){
+    data->window[i] = 0.5 - 0.5*cos(2.0*M_PI*i/grain);
+  }
+
+  data->grain = grain;
+  data->hop = hop;
+  data->range = range;
+  data->overlap = overlap;
+  data->history_size = history;
+  data->correlation_size = correlation;
+  data->written = 0;
+  data->ready_pos = 0;
+  data->position = 0.0;
+  data->started = 0;
+  return 1;
+}
+
+static inline float history_at(struct wsola_data *data, long i){
+  return data->history[(size_t)i & (data->history_size-1)];
+}
+
+// Find the offset within the search range around start at which the
+// input is most similar to the continuation of the previous grain.
+static long wsola_search(long start, long continuation, struct wsola_data *data){
+  size_t size = data->correlation_size;
+  size_t range = data->range;
+  size_t overlap = data->overlap;
+  size_t length = overlap + 2*range;
+  float *search = data->search;
+  float *target = data->target;
+  float *energy = data->energy;
+  struct fft_plan *plan = &data->tables->plan;
+
+  for(size_t i=0; i<length; ++i){
+    search[i] = history_at(data, start - range + i);
+  }
+  memset(search+length, 0, (size-length)*sizeof(float));
+  for(size_t i=0; i<overlap; ++i){
+    target[i] = history_at(data, continuation + i);
+  }
+  memset(target+overlap, 0, (size-overlap)*sizeof(float));
+
+  // The correlation is the inverse of one spectrum times the
+  // conjugate of the other.
+  fft_forward(search, search, plan);
+  fft_forward(target, target, plan);
+  for(size_t k=0; k<=size/2; ++k){
+    float sr = search[2*k], si = search[2*k+1];
+    float tr = target[2*k], ti = target[2*k+1];
+    search[2*k] = sr*tr + si*ti;
+    search[2*k+1] = si*tr - sr*ti;
+  }
+  fft_inverse(search, search, plan);
+
+  // Normalise by the energy of each candidate so that louder parts
+  // of the search range are not preferred.
+  float sum = 0.0;
+  for(size_t i=0; i<overlap; ++i){
+    float s = history_at(data, start - range + i);
+    sum += s*s;
+  }
+  for(size_t d=0; d<=2*range; ++d){
+    energy[d] = sum;
+    float in = history_at(data, start - range + d + overlap);
+    float out = history_at(data, start - range + d);
+    sum += in*in - out*out;
+  }
+
+  long best = 0;
+  float best_score = -INFINITY;
+  for(size_t d=0; d<=2*range; ++d){
+    float score = search[d] / sqrtf(energy[d] + 1e-9f);
+    if(best_score < score){
+      best_score = score;
+      best = d;
+    }
+  }
+  return best - (long)range;
+}
+
+// Produce the next hop of output samples into the ready buffer.
+static void wsola_grain(float pitch, struct wsola_data *data){
+  size_t grain = data->grain;
+  size_t hop = data->hop;
+  float *window = data->window;
+  float *ola = data->ola;
+  // The grain reads pitch*grain samples, so it has to start far enough
+  // behind the input, and the search may move it further ahead.
+  long start = (long)data->written - (long)data->range - (long)ceil(grain*pitch) - 1;
+
+  if(data->started){
+    long continuation = (long)(data->position + hop*pitch);
+    start += wsola_search(start, continuation, data);
+  }
+  data->started = 1;
+  data->position = start;
+
+  for(size_t i=0; i<grain; ++i){
+    float x = i*pitch;
+    long index = (long)x;
+    float t = x - index;
+    float a = history_at(data, start + index);
+    float b = history_at(data, start + index + 1);
+    ola[i] += window[i] * (a + t*(b - a));
+  }
+
+  memcpy(data->ready, ola, hop*sizeof(float));
+  memmove(ola, ola+hop, (grain-hop)*sizeof(float));
+  memset(ola+grain-hop, 0, hop*sizeof(float));
+}
+
+static inline float wsola_clamp(float pitch){
+  return (pitch < WSOLA_MIN_PITCH)? WSOLA_MIN_PITCH : ((WSOLA_MAX_PITCH < pitch)? WSOLA_MAX_PITCH : pitch);
+}
+
+// A grain starts range + ceil(grain*pitch) + 1 samples behind the
+// input and is played from the moment it is made. Its centre was read
+// grain*pitch/2 samples after its start but is played grain/2 samples
+// after it, which gives about range + 1 + grain*(1+pitch)/2 samples, or
+// 5ms at a pitch of 0.5 and 9ms at 2. The search moves the grains by
+// up to the range either way.
+size_t wsola_latency(float pitch, struct wsola_data *data){
+  double read = ceil(data->grain*wsola_clamp(pitch));
+  return data->range + 1 + (size_t)(read + data->grain*(1.0 - wsola_clamp(pitch))/2 + 0.5);
+}
+
+void wsola_shift(float pitch, float *in, float *out, size_t samples, struct wsola_data *data){
+  size_t hop = data->hop;
+  size_t mask = data->history_size-1;
+  float *history = data->history;
+  pitch = wsola_clamp(pitch);
+
+  size_t i = 0;
+  while(i < samples){
+    size_t chunk = smin(samples-i, hop-data->ready_pos);
+    for(size_t j=0; j<chunk; ++j){
+      history[(data->written+j) & mask] = in[i+j];
+    }
+    memcpy(out+i, data->ready+data->ready_pos, chunk*sizeof(float));
+    data->written += chunk;
+    data->ready_pos += chunk;
+    i += chunk;
+
+    if(data->ready_pos == hop){
+      data->ready_pos = 0;
+      wsola_grain(pitch, data);
+    }
+  }
+}
@@ -2,6 +2,7 @@
 #include <mpg123.h>
 #include <out123.h>
 #include <signal.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -0,0 +1,121 @@
+#include "common.h"
+
+// Feeds falling ramps of various lengths through the compressor set up
+// as a limiter, and fails if the output ever exceeds the threshold.
+
+// Leeway for the rounding of the gain computation.
+#define TOLERANCE 1e-5
+
+struct limiter_case{
+  size_t samplerate;
+  float lookahead;
+  float release;
+  float threshold;
+  size_t samples;
+};
+
+struct ramp{
+  uint32_t random;
+  size_t position;
+  size_t length;
+  size_t end;
+  float peak;
+};
+
+uint32_t ramp_random(struct ramp *ramp){
+  ramp->random = ramp->random*1103515245 + 12345;
+  return ramp->random >> 16;
+}
+
+// A ramp falls from a random peak to silence over a random number of
+// samples, and is followed by a random stretch of silence.
+float falling_ramp(struct ramp *ramp){
+  if(ramp->position == ramp->end){
+    ramp->position = 0;
+    ramp->length = 1 + ramp_random(ramp) % 64;
+    ramp->end = ramp->length + ramp_random(ramp) % 16;
+    ramp->peak = (ramp_random(ramp) / 32768.0) - 1.0;
+  }
+  size_t position = ramp->position++;
+  if(position < ramp->length){
+    return ramp->peak * (ramp->length - position) / ramp->length;
+  }
+  return 0.0;
+}
+
+int main(int argc, char **argv){
+  int exit = 1;
+  size_t duration = 5;
+  float ratio = INFINITY;
+  struct limiter_case cases[] = {
+    {1000, 0.004, 0.0, -20.0, 100},
+    {1000, 0.004, 0.1, -20.0, 64},
+    {44100, 0.005, 0.0, -6.0, 512},
+    {44100, 0.005, 0.1, -1.0, 441},
+    {48000, 0.001, 0.05, -12.0, 256},
+  };
+  struct mixed_segment compressor = {0};
+  struct mixed_buffer in = {0}, out = {0};
+
+  if(1 < argc){
+    duration = strtol(argv[1], 0, 10);
+    if(duration <= 0){
+      fprintf(stderr, "Usage: ./test_compressor [seconds]\n");
+      return 0;
+    }
+  }
+
+  if(!mixed_make_buffer(1024, &in) ||
+     !mixed_make_buffer(1024, &out)){
+    fprintf(stderr, "Failed to allocate buffers: %s\n", mixed_error_string(-1));
+    goto cleanup;
+  }
+
+  for(size_t c=0; c<sizeof(cases)/sizeof(struct limiter_case); ++c){
+    struct limiter_case *limiter = &cases[c];
+    float threshold = pow(10.0, limiter->threshold/20.0);
+    float max_out = 0.0;
+    struct ramp ramp = {1};
+
+    if(!mixed_make_segment_compressor(1, limiter->samplerate, &compressor) ||
+       !mixed_segment_set_in(MIXED_BUFFER, 0, &in, &compressor) ||
+       !mixed_segment_set_out(MIXED_BUFFER, 0, &out, &compressor) ||
+       !mixed_segment_set(MIXED_COMPRESSOR_LOOKAHEAD, &limiter->lookahead, &compressor) ||
+       !mixed_segment_set(MIXED_COMPRESSOR_RELEASE, &limiter->release, &compressor) ||
+       !mixed_segment_set(MIXED_COMPRESSOR_THRESHOLD, &limiter->threshold, &compressor) ||
+       !mixed_segment_set(MIXED_COMPRESSOR_RATIO, &ratio, &compressor)){
+      fprintf(stderr, "Failed to create segment: %s\n", mixed_error_string(-1));
+      goto cleanup;
+    }
+
+    mixed_segment_start(&compressor);
+    for(size_t t=0; t<duration*limiter->samplerate; t+=limiter->samples){
+      for(size_t i=0; i<limiter->samples; ++i){
+        in.data[i] = falling_ramp(&ramp);
+      }
+      mixed_segment_mix(limiter->samples, &compressor);
+      for(size_t i=0; i<limiter->samples; ++i){
+        if(max_out < fabs(out.data[i])) max_out = fabs(out.data[i]);
+      }
+    }
+    mixed_segment_end(&compressor);
+
+    int ok = (max_out <= threshold*(1.0+TOLERANCE));
+    printf("Samplerate %5zu, lookahead %.3fs, release %.2fs: max output %.4f, threshold %.4f %s\n",
+           limiter->samplerate, limiter->lookahead, limiter->release,
+           max_out, threshold, ok? "ok" : "FAILED");
+    if(!ok) goto cleanup;
+
+    mixed_free_segment(&compressor);
+  }
+
+  exit = 0;
+
+ cleanup:
+
+  mixed_free_segment(&compressor);
+  mixed_free_buffer(&in);
+  mixed_free_buffer(&out);
+
+  return exit;
+}
@@ -0,0 +1,246 @@
+#include "common.h"
+
+// Compares the output of the phase vocoder against a straightforward
+// double precision implementation of the same algorithm, and fails if
+// any sample deviates by more than the documented bound, both with and
+// without MIXED_FAST_MATH.
+
+#define MAX_ERROR 3e-4
+
+struct reference{
+  size_t framesize;
+  size_t oversampling;
+  size_t fill;
+  double samplerate;
+  double *window;
+  double *synthesis_window;
+  double *in_fifo;
+  double *out_fifo;
+  double *accumulator;
+  double *real;
+  double *imag;
+  double *last_phase;
+  double *phase_sum;
+  double *analyzed_frequency;
+  double *analyzed_magnitude;
+  double *synthesized_frequency;
+  double *synthesized_magnitude;
+};
+
+void free_reference(struct reference *ref){
+  free(ref->window);
+  ref->window = 0;
+}
+
+int make_reference(size_t framesize, size_t oversampling, size_t samplerate, struct reference *ref){
+  size_t step = framesize/oversampling;
+  double *memory = calloc(framesize*12, sizeof(double));
+  if(!memory) return 0;
+  ref->window = memory; memory += framesize;
+  ref->synthesis_window = memory; memory += framesize;
+  ref->in_fifo = memory; memory += framesize;
+  ref->out_fifo = memory; memory += framesize;
+  ref->accumulator = memory; memory += framesize*2;
+  ref->real = memory; memory += framesize;
+  ref->imag = memory; memory += framesize;
+  ref->last_phase = memory; memory += framesize/2+1;
+  ref->phase_sum = memory; memory += framesize/2+1;
+  ref->analyzed_frequency = memory; memory += framesize/2+1;
+  ref->analyzed_magnitude = memory; memory += framesize/2+1;
+  ref->synthesized_frequency = memory; memory += framesize/2+1;
+  ref->synthesized_magnitude = memory; memory += framesize/2+1;
+  ref->framesize = framesize;
+  ref->oversampling = oversampling;
+  ref->samplerate = samplerate;
+  ref->fill = framesize - step;
+  for(size_t k=0; k<framesize; ++k){
+    ref->window[k] = 0.5 - 0.5*cos(2.0*M_PI*k/framesize);
+  }
+  for(size_t k=0; k<framesize; ++k){
+    double sum = 0.0;
+    for(size_t j=k%step; j<framesize; j+=step){
+      sum += ref->window[j]*ref->window[j];
+    }
+    ref->synthesis_window[k] = ref->window[k]/(sum*framesize);
+  }
+  return 1;
+}
+
+// Unnormalised complex FFT, with sign -1 being the forward direction.
+void reference_fft(double *real, double *imag, size_t n, int sign){
+  for(size_t i=1, j=0; i<n; ++i){
+    size_t bit = n >> 1;
+    for(; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if(i < j){
+      double t = real[i]; real[i] = real[j]; real[j] = t;
+      t = imag[i]; imag[i] = imag[j]; imag[j] = t;
+    }
+  }
+  for(size_t length=2; length<=n; length*=2){
+    double angle = sign*2.0*M_PI/length;
+    for(size_t i=0; i<n; i+=length){
+      for(size_t j=0; j<length/2; ++j){
+        double wr = cos(angle*j), wi = sin(angle*j);
+        double *ar = real+i+j, *ai = imag+i+j;
+        double *br = real+i+j+length/2, *bi = imag+i+j+length/2;
+        double tr = *br*wr - *bi*wi, ti = *br*wi + *bi*wr;
+        *br = *ar - tr; *bi = *ai - ti;
+        *ar += tr; *ai += ti;
+      }
+    }
+  }
+}
+
+void reference_frame(float pitch, struct reference *ref){
+  long framesize = ref->framesize;
+  long framesize2 = framesize/2;
+  long oversampling = ref->oversampling;
+  long step = framesize/oversampling;
+  double bin_frequencies = ref->samplerate/framesize;
+  double expected = 2.0*M_PI*step/framesize;
+  double *real = ref->real, *imag = ref->imag;
+
+  for(long k=0; k<framesize; ++k){
+    real[k] = ref->in_fifo[k]*ref->window[k];
+    imag[k] = 0.0;
+  }
+  reference_fft(real, imag, framesize, -1);
+
+  for(long k=0; k<=framesize2; ++k){
+    double phase = atan2(imag[k], real[k]);
+    double tmp = phase - ref->last_phase[k];
+    ref->last_phase[k] = phase;
+    tmp = remainder(tmp - k*expected, 2.0*M_PI);
+    ref->analyzed_frequency[k] = (k + tmp*oversampling/(2.0*M_PI))*bin_frequencies;
+    ref->analyzed_magnitude[k] = 1.5*sqrt(real[k]*real[k] + imag[k]*imag[k]);
+  }
+
+  memset(ref->synthesized_frequency, 0, (framesize2+1)*sizeof(double));
+  memset(ref->synthesized_magnitude, 0, (framesize2+1)*sizeof(double));
+  for(long k=0; k<=framesize2; ++k){
+    // The bins are mapped with the same float product as the vocoder.
+    long index = k*pitch;
+    if(index <= framesize2){
+      ref->synthesized_magnitude[index] += ref->analyzed_magnitude[k];
+      ref->synthesized_frequency[index] = ref->analyzed_frequency[k]*pitch;
+    }
+  }
+
+  for(long k=0; k<=framesize2; ++k){
+    double tmp = (ref->synthesized_frequency[k]/bin_frequencies - k)*2.0*M_PI/oversampling;
+    ref->phase_sum[k] += tmp + k*expected;
+    real[k] = ref->synthesized_magnitude[k]*cos(ref->phase_sum[k]);
+    imag[k] = ref->synthesized_magnitude[k]*sin(ref->phase_sum[k]);
+  }
+  // The imaginary parts of DC and nyquist are dropped by a real transform.
+  imag[0] = 0.0;
+  imag[framesize2] = 0.0;
+  for(long k=1; k<framesize2; ++k){
+    real[framesize-k] = real[k];
+    imag[framesize-k] = -imag[k];
+  }
+  reference_fft(real, imag, framesize, 1);
+
+  for(long k=0; k<framesize; ++k){
+    ref->accumulator[k] += ref->synthesis_window[k]*real[k];
+  }
+  memcpy(ref->out_fifo, ref->accumulator, step*sizeof(double));
+  memmove(ref->accumulator, ref->accumulator+step, framesize*sizeof(double));
+  memmove(ref->in_fifo, ref->in_fifo+step, (framesize-step)*sizeof(double));
+}
+
+double reference_shift(float pitch, double in, struct reference *ref){
+  size_t overlap = ref->framesize - ref->framesize/ref->oversampling;
+  double out = ref->out_fifo[ref->fill-overlap];
+  ref->in_fifo[ref->fill++] = in;
+  if(ref->fill == ref->framesize){
+    reference_frame(pitch, ref);
+    ref->fill = overlap;
+  }
+  return out;
+}
+
+int main(int argc, char **argv){
+  int exit = 1;
+  size_t samples = 512;
+  size_t samplerate = 44100;
+  size_t duration = 5;
+  size_t framesize, oversampling;
+  float pitches[] = {0.5, 0.75, 1.5, 2.0};
+  struct mixed_segment pitch = {0};
+  struct mixed_buffer in = {0}, out = {0};
+  struct reference ref = {0};
+
+  if(1 < argc){
+    duration = strtol(argv[1], 0, 10);
+    if(duration <= 0){
+      fprintf(stderr, "Usage: ./test_vocoder [seconds]\n");
+      return 0;
+    }
+  }
+
+  if(!mixed_make_buffer(samples, &in) ||
+     !mixed_make_buffer(samples, &out)){
+    fprintf(stderr, "Failed to allocate buffers: %s\n", mixed_error_string(-1));
+    goto cleanup;
+  }
+
+  for(size_t p=0; p<2*sizeof(pitches)/sizeof(float); ++p){
+    float shift = pitches[p%(sizeof(pitches)/sizeof(float))];
+    bool fast_math = (p < sizeof(pitches)/sizeof(float));
+    double max_error = 0.0;
+    uint32_t random = 1;
+
+    if(!mixed_make_segment_pitch(shift, samplerate, &pitch) ||
+       !mixed_segment_set(MIXED_FAST_MATH, &fast_math, &pitch) ||
+       !mixed_segment_set_in(MIXED_BUFFER, MIXED_MONO, &in, &pitch) ||
+       !mixed_segment_set_out(MIXED_BUFFER, MIXED_MONO, &out, &pitch) ||
+       !mixed_segment_get(MIXED_PITCH_FRAMESIZE, &framesize, &pitch) ||
+       !mixed_segment_get(MIXED_PITCH_OVERSAMPLING, &oversampling, &pitch)){
+      fprintf(stderr, "Failed to create segment: %s\n", mixed_error_string(-1));
+      goto cleanup;
+    }
+    if(!make_reference(framesize, oversampling, samplerate, &ref)){
+      fprintf(stderr, "Failed to allocate the reference.\n");
+      goto cleanup;
+    }
+
+    mixed_segment_start(&pitch);
+    for(size_t t=0; t<duration*samplerate; t+=samples){
+      // Two tones with a vibrato and a little noise.
+      for(size_t i=0; i<samples; ++i){
+        double time = (double)(t+i)/samplerate;
+        random = random*1103515245 + 12345;
+        in.data[i] = 0.4*sin(2*M_PI*(220*time + 2*sin(2*M_PI*5*time)))
+          + 0.2*sin(2*M_PI*1370*time)
+          + 0.05*((random >> 16)/32768.0 - 1.0);
+      }
+      mixed_segment_mix(samples, &pitch);
+      for(size_t i=0; i<samples; ++i){
+        double error = fabs(out.data[i] - reference_shift(shift, in.data[i], &ref));
+        if(max_error < error) max_error = error;
+      }
+    }
+    mixed_segment_end(&pitch);
+
+    printf("Pitch %4.2f, frame size %4zu, oversampling %zu, %s: max error %.2e %s\n",
+           shift, framesize, oversampling, fast_math? "fast math" : "libm", max_error,
+           (max_error <= MAX_ERROR)? "ok" : "FAILED");
+    if(MAX_ERROR < max_error) goto cleanup;
+
+    mixed_free_segment(&pitch);
+    free_reference(&ref);
+  }
+
+  exit = 0;
+
+ cleanup:
+
+  mixed_free_segment(&pitch);
+  free_reference(&ref);
+  mixed_free_buffer(&in);
+  mixed_free_buffer(&out);
+
+  return exit;
+}